@@ -242,6 +242,16 @@ public:
    */
   Node *lower_bound_node(Key_param_type key) const;
 
+  /**
+   * Get the root node of the tree.
+   *
+   * \return A pointer to the root node, or `NULL` if the tree is empty.
+   *
+   * Searches that use augmented data of the nodes (see Avl_tree) start here
+   * and walk down the tree with Fwd_iter_ops::child().
+   */
+  Node *root_node() const { return head(); }
+
   /**
    * \brief find the node with the given \a key.
    * \param key The key value of the element to search.
@@ -28,6 +28,7 @@ L4_RPC_DEF(L4Re::Dataspace::clear);
 L4_RPC_DEF(L4Re::Dataspace::allocate);
 L4_RPC_DEF(L4Re::Dataspace::copy_in);
 L4_RPC_DEF(L4Re::Dataspace::info);
+L4_RPC_DEF(L4Re::Dataspace_map_info::map_info);
 
 namespace L4Re {
 
@@ -44,10 +44,40 @@ Rm::attach(l4_addr_t *start, unsigned long size, Rm::Flags flags,
            L4::Ipc::Cap<Dataspace> mem, Rm::Offset offs,
            unsigned char align) const noexcept
 {
-  if (((flags & F::Rights_mask) == Flags(0)) || (flags & F::Reserved))
+  bool ds_aligned = flags.raw & F::Ds_aligned;
+  flags = Flags(flags.raw & ~l4_uint32_t(F::Ds_aligned));
+
+  unsigned char search_align = align;
+  if (flags & F::Reserved)
     mem = L4::Ipc::Cap<L4Re::Dataspace>();
+  else if (ds_aligned && (flags & F::Search_addr) && align < L4_SUPERPAGESHIFT
+           && size >= L4_SUPERPAGESIZE && mem.cap().is_valid())
+    {
+      // Place large regions of contiguous memory at an address aligned like
+      // the backing memory, so that they are mapped with superpages.
+      l4_addr_t ds_start, ds_end;
+      if (L4::cap_reinterpret_cast<Dataspace_map_info>(mem.cap())
+            ->map_info(&ds_start, &ds_end) > 0)
+        {
+          l4_addr_t a = ds_start + l4_trunc_page(offs);
+          unsigned char o = L4_SUPERPAGESHIFT;
+          while (o > align && (a & ((1UL << o) - 1)))
+            --o;
+          search_align = o;
+        }
+    }
+
+  l4_addr_t addr = *start;
+  long e = attach_t::call(c(), start, size, flags, mem, offs, search_align,
+                          mem.cap().cap());
+  if ((e == -L4_ENOENT || e == -L4_EADDRNOTAVAIL) && search_align != align)
+    {
+      // no free range with that alignment, take any suitable one
+      *start = addr;
+      e = attach_t::call(c(), start, size, flags, mem, offs, align,
+                         mem.cap().cap());
+    }
 
-  long e = attach_t::call(c(), start, size, flags, mem, offs, align, mem.cap().cap());
   if (e < 0)
     return e;
 
@@ -41,6 +41,7 @@ enum l4re_aux_ldr_flags_t
   L4RE_AUX_LDR_FLAG_EAGER_MAP    = 0x1,
   L4RE_AUX_LDR_FLAG_ALL_SEGS_COW = 0x2,
   L4RE_AUX_LDR_FLAG_PINNED_SEGS  = 0x4,
+  L4RE_AUX_LDR_FLAG_PREFETCH     = 0x8,
 };
 
 /**
@@ -22,6 +22,8 @@
  */
 #pragma once
 
+#include <l4/sys/l4int.h>
+
 namespace L4Re
 {
   namespace Log_
@@ -30,7 +32,40 @@ namespace L4Re
      * \brief Logging-service communication-protocol opcodes.
      * \ingroup api_l4re_protocols
      * \internal
+     *
+     * `Setup_ring` takes the requested size of the ring data in bytes in
+     * the second message word (0 for the server's default) and returns the
+     * dataspace with the ring and the IRQ that is the doorbell of the
+     * server as two capabilities. A log object has at most one ring, a
+     * second request fails with -L4_EBUSY. Servers without support for
+     * the ring return an error or no capabilities.
      */
-    enum Opcodes { Print };
+    enum Opcodes { Print, Setup_ring = 0x10 };
+
+    /**
+     * \brief Header of a shared-memory log ring.
+     * \ingroup api_l4re_protocols
+     * \internal
+     *
+     * The header starts the dataspace of the ring and is directly followed
+     * by the ring data. The client is the only producer, the server the
+     * only consumer. `head` and `tail` run freely and are taken modulo
+     * `size`.
+     *
+     * After writing, the client clears `armed` and triggers the doorbell if
+     * it was set. The server sets `armed` after it drained the ring, so
+     * there is at most one doorbell per batch of log output.
+     */
+    struct Ring
+    {
+      l4_uint32_t head;    ///< Bytes written by the client.
+      l4_uint32_t tail;    ///< Bytes consumed by the server.
+      l4_uint32_t size;    ///< Size of the ring data, a power of 2.
+      l4_uint32_t armed;   ///< The server waits for the doorbell.
+      l4_uint32_t dropped; ///< Bytes the client dropped for a full ring.
+      l4_uint32_t _pad[3];
+
+      char *data() { return reinterpret_cast<char *>(this + 1); }
+    };
   };
 };
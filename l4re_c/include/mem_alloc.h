@@ -43,6 +43,9 @@ enum l4re_ma_flags {
   L4RE_MA_CONTINUOUS  = 0x01,
   L4RE_MA_PINNED      = 0x02,
   L4RE_MA_SUPER_PAGES = 0x04,
+  L4RE_MA_NUMA_NODE   = 0x08,
+  L4RE_MA_NUMA_NODE_SHIFT = 8,
+  L4RE_MA_NUMA_NODE_MASK  = 0xff00,
 };
 
 
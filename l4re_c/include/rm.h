@@ -45,6 +45,7 @@ enum l4re_rm_flags_values {
   L4RE_RM_F_RW   = L4RE_DS_F_RW,
   L4RE_RM_F_RWX  = L4RE_DS_F_RWX,
 
+  L4RE_RM_F_PRIVATE      = 0x100, /**< The region is a private copy-on-write view of the data space */
   L4RE_RM_F_NO_ALIAS     = 0x200, /**< The region contains exclusive memory that is not mapped anywhere else */
   L4RE_RM_F_PAGER        = 0x400, /**< Region has a pager */
   L4RE_RM_F_RESERVED     = 0x800, /**< Region is reserved (blocked) */
@@ -65,6 +66,7 @@ enum l4re_rm_flags_values {
   /** Cache bits for uncached memory */
   L4RE_RM_F_CACHE_UNCACHED = L4RE_DS_F_UNCACHEABLE,
 
+  L4RE_RM_F_DS_ALIGNED   = 0x10000, /**< Align like the memory of the data space */
   L4RE_RM_F_SEARCH_ADDR  = 0x20000, /**< Search for a suitable address range */
   L4RE_RM_F_IN_AREA      = 0x40000, /**< Search only in area, or map into area */
   L4RE_RM_F_EAGER_MAP    = 0x80000, /**< Eagerly map the attached data space in. */
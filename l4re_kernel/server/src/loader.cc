@@ -213,6 +213,20 @@ L4Re_app_model::all_segs_cow()
   return Global::l4re_aux->ldr_flags & L4RE_AUX_LDR_FLAG_ALL_SEGS_COW;
 }
 
+bool
+L4Re_app_model::prefetch_segs()
+{
+  return Global::l4re_aux->ldr_flags & L4RE_AUX_LDR_FLAG_PREFETCH;
+}
+
+void
+L4Re_app_model::prefetch_ds(Dataspace ds, unsigned long offs,
+                            unsigned long size)
+{
+  // only a hint, the memory is still allocated on demand if this fails
+  ds->allocate(offs, size);
+}
+
 L4Re::Env *
 L4Re_app_model::add_env()
 {
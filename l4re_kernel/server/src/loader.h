@@ -85,6 +85,10 @@ struct L4Re_app_model : public Ldr::Base_app_model<L4Re_stack>
                       unsigned long size);
 
   static bool all_segs_cow();
+  static bool prefetch_segs();
+
+  static void prefetch_ds(Dataspace ds, unsigned long offs,
+                          unsigned long size);
 
   l4_addr_t local_attach_ds(Const_dataspace ds, unsigned long size,
                             unsigned long offset) const;
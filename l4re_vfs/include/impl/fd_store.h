@@ -36,9 +36,14 @@ public:
   Ref_ptr<L4Re::Vfs::File> get(int fd) noexcept;
   void set(int fd, Ref_ptr<L4Re::Vfs::File> const &f) noexcept;
 
+  /// Generation of `fd`, changes whenever the descriptor is set or freed.
+  unsigned long generation(int fd) noexcept
+  { return check_fd(fd) ? _gen[fd] : 0; }
+
 private:
   int _fd_hint;
   Ref_ptr<L4Re::Vfs::File> _files[MAX_FILES];
+  unsigned long _gen[MAX_FILES] = {};
 };
 
 inline
@@ -63,6 +68,7 @@ void
 Fd_store::set(int fd, Ref_ptr<L4Re::Vfs::File> const &f) noexcept
 {
   _files[fd] = f;
+  ++_gen[fd];
 }
 
 }}
@@ -38,6 +38,7 @@ void
 Fd_store::free(int fd) noexcept
 {
   _files[fd] = 0;
+  ++_gen[fd];
   if (fd < _fd_hint)
     _fd_hint = fd;
 }
@@ -19,19 +19,49 @@
 
 #include <l4/sys/capability>
 #include <l4/sys/vcon>
-#include <l4/sys/semaphore>
+#include <l4/re/util/log_ring>
 
 #include <l4/l4re_vfs/backend>
 
 namespace L4Re { namespace Core {
 
+/**
+ * File for a L4::Vcon.
+ *
+ * The output of one writev() call is combined in a buffer and sent in as
+ * few IPCs as possible. Nothing stays buffered after writev() returns. If
+ * the vcon server supports a shared-memory log ring (L4Re::Util::Log_ring),
+ * output goes to the ring instead. When the ring is full, output is sent
+ * by IPC, which blocks on the server and keeps the order with the output
+ * in the ring.
+ */
 class Vcon_stream : public L4Re::Vfs::Be_file_stream
 {
 private:
+  enum
+  {
+    Wbuf_size     = L4_VCON_WRITE_SIZE,
+  };
+
+  enum Ring_state { Ring_untried, Ring_active, Ring_unsupported };
+
   L4::Cap<L4::Vcon> _s;
-  L4::Cap<L4::Semaphore>  _irq;
   unsigned _irq_bound;
 
+  int _wlock;
+  unsigned _wlen;
+  Ring_state _ring_state;
+  L4Re::Util::Log_ring _ring;
+  char _wbuf[Wbuf_size];
+
+  int bind_notifier() noexcept;
+
+  void lock_write() noexcept;
+  void unlock_write() noexcept;
+  void send(char const *b, unsigned long len) noexcept;
+  void flush_locked() noexcept;
+  void init_ring() noexcept;
+
 public:
   explicit Vcon_stream(L4::Cap<L4::Vcon> s) noexcept;
 
@@ -41,6 +71,7 @@ public:
   int get_status_flags() const noexcept override { return O_RDWR; }
   int set_status_flags(long) noexcept override { return 0; }
   int ioctl(unsigned long request, va_list args) noexcept override;
+  short poll_events(short events) noexcept override;
 
   ~Vcon_stream() noexcept {}
   void operator delete (void *) {}
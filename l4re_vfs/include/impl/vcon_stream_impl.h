@@ -18,6 +18,9 @@
 
 #include <l4/re/env>
 #include <l4/sys/factory>
+#include <l4/sys/ipc.h>
+#include <l4/sys/kip.h>
+#include <l4/sys/thread.h>
 #include <l4/cxx/minmax>
 
 #include "vcon_stream.h"
@@ -29,12 +32,96 @@
 
 namespace L4Re { namespace Core {
 Vcon_stream::Vcon_stream(L4::Cap<L4::Vcon> s) noexcept
-: Be_file_stream(),
-  _s(s), _irq(L4Re::virt_cap_alloc->alloc<L4::Semaphore>()), _irq_bound(false)
+: Be_file_stream(), _s(s), _irq_bound(false), _wlock(0), _wlen(0),
+  _ring_state(Ring_untried)
+{}
+
+void
+Vcon_stream::lock_write() noexcept
 {
-  // [[maybe_unused]] int res =
-  l4_error(L4Re::Env::env()->factory()->create(_irq));
-  // (void)res; // handle errors!
+  while (__atomic_exchange_n(&_wlock, 1, __ATOMIC_ACQUIRE))
+    l4_thread_yield();
+}
+
+void
+Vcon_stream::unlock_write() noexcept
+{ __atomic_store_n(&_wlock, 0, __ATOMIC_RELEASE); }
+
+/**
+ * Send output to the vcon, at most Wbuf_size bytes.
+ *
+ * \pre The write lock is held.
+ */
+void
+Vcon_stream::send(char const *b, unsigned long len) noexcept
+{
+  // A full ring falls back to the IPC. The server prints what is in the
+  // ring before the message, so the order of the output is kept.
+  if (_ring_state == Ring_active && _ring.write(b, len))
+    return;
+
+  // Only save the message registers used by the send, the caller may be
+  // in the middle of composing a message.
+  enum
+  {
+    Words = 2 + (Wbuf_size + sizeof(l4_umword_t) - 1) / sizeof(l4_umword_t)
+  };
+  l4_umword_t store[Words];
+  unsigned words = 2 + l4_bytes_to_mwords(len);
+  l4_msg_regs_t *mr = l4_utcb_mr();
+
+  Vfs_config::memcpy(store, mr->mr, words * sizeof(l4_umword_t));
+  _s->send(b, len);
+  Vfs_config::memcpy(mr->mr, store, words * sizeof(l4_umword_t));
+}
+
+/// \pre The write lock is held.
+void
+Vcon_stream::flush_locked() noexcept
+{
+  if (_wlen)
+    send(_wbuf, _wlen);
+  _wlen = 0;
+}
+
+/**
+ * Try to set up the log ring with the vcon server.
+ *
+ * \pre The write lock is held.
+ */
+void
+Vcon_stream::init_ring() noexcept
+{
+  // The setup takes several IPCs, the caller may be in the middle of
+  // composing a message.
+  l4_msg_regs_t store;
+  l4_msg_regs_t *mr = l4_utcb_mr();
+
+  Vfs_config::memcpy(&store, mr, sizeof(store));
+  _ring_state = _ring.init(_s) == 0 ? Ring_active : Ring_unsupported;
+  Vfs_config::memcpy(mr, &store, sizeof(store));
+}
+
+/**
+ * Let the vcon signal new input to the I/O notifier of the VFS.
+ *
+ * Blocking reads and poll() wait for the notifier.
+ */
+int
+Vcon_stream::bind_notifier() noexcept
+{
+  if (_irq_bound)
+    return 0;
+
+  bool was_bound = __atomic_exchange_n(&_irq_bound, true, __ATOMIC_SEQ_CST);
+  if (!was_bound)
+    if (l4_error(_s->bind(0, L4Re::Vfs::vfs_ops->io_notifier())) < 0)
+      {
+        _irq_bound = false;
+        return -EIO;
+      }
+
+  return 0;
 }
 
 ssize_t
@@ -43,13 +130,9 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) noexcept
   if (iovcnt < 0)
     return -EINVAL;
 
-  if (!_irq_bound)
-    {
-      bool was_bound = __atomic_exchange_n(&_irq_bound, true, __ATOMIC_SEQ_CST);
-      if (!was_bound)
-        if (l4_error(_s->bind(0, _irq)) < 0)
-          return -EIO;
-    }
+  int err = bind_notifier();
+  if (err < 0)
+    return err;
 
   ssize_t bytes = 0;
   for (; iovcnt > 0; --iovcnt, ++iovec)
@@ -63,6 +146,9 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) noexcept
       while (1)
         {
           size_t l = cxx::min<size_t>(L4_VCON_READ_SIZE, len);
+          // taken before the read to not miss the notification for input
+          // that arrives right after it
+          unsigned long gen = L4Re::Vfs::vfs_ops->io_generation();
           int ret = _s->read(buf, l);
 
           if (ret > static_cast<int>(l))
@@ -75,14 +161,10 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) noexcept
               if (bytes)
                 return bytes;
 
-              ret = _s->read(buf, l);
-              if (ret < 0)
-                return ret;
-              else if (ret == 0)
-                {
-                  _irq->down();
-                  continue;
-                }
+              err = L4Re::Vfs::vfs_ops->io_wait(gen, ~0ULL);
+              if (err < 0 && err != -EINTR)
+                return err;
+              continue;
             }
 
           bytes += ret;
@@ -100,13 +182,13 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) noexcept
 ssize_t
 Vcon_stream::writev(const struct iovec *iovec, int iovcnt) noexcept
 {
-  l4_msg_regs_t store;
-  l4_msg_regs_t *mr = l4_utcb_mr();
-
   if (iovcnt < 0)
     return -EINVAL;
 
-  Vfs_config::memcpy(&store, mr, sizeof(store));
+  lock_write();
+
+  if (_ring_state == Ring_untried)
+    init_ring();
 
   ssize_t written = 0;
   while (iovcnt)
@@ -114,22 +196,61 @@ Vcon_stream::writev(const struct iovec *iovec, int iovcnt) noexcept
       size_t sl = cxx::min<size_t>(iovec->iov_len, SSIZE_MAX - written);
       char const *b = static_cast<char const *>(iovec->iov_base);
 
-      for (; sl > L4_VCON_WRITE_SIZE
-           ; sl -= L4_VCON_WRITE_SIZE, b += L4_VCON_WRITE_SIZE,
-             written += L4_VCON_WRITE_SIZE)
-        _s->send(b, L4_VCON_WRITE_SIZE);
-
-      _s->send(b, sl);
-
       written += sl;
 
+      if (_ring_state == Ring_active)
+        {
+          // the ring combines the output itself
+          for (; sl > Wbuf_size; sl -= Wbuf_size, b += Wbuf_size)
+            send(b, Wbuf_size);
+          if (sl)
+            send(b, sl);
+        }
+      else
+        {
+          while (sl)
+            {
+              size_t n = cxx::min<size_t>(sl, Wbuf_size - _wlen);
+              Vfs_config::memcpy(_wbuf + _wlen, b, n);
+              _wlen += n;
+              b += n;
+              sl -= n;
+
+              if (_wlen == Wbuf_size)
+                flush_locked();
+            }
+        }
+
       ++iovec;
       --iovcnt;
     }
-  Vfs_config::memcpy(mr, &store, sizeof(store));
+
+  flush_locked();
+
+  unlock_write();
   return written;
 }
 
+short
+Vcon_stream::poll_events(short events) noexcept
+{
+  short ready = events & POLLOUT;
+  if (!(events & POLLIN))
+    return ready;
+
+  if (bind_notifier() < 0)
+    return ready | POLLERR;
+
+  // a read of zero bytes reports if there is pending input
+  int ret = _s->read(nullptr, 0);
+  if (ret < 0)
+    return ready | POLLERR;
+  if (ret > 0)
+    ready |= POLLIN;
+
+  return ready;
+}
+
 int
 Vcon_stream::fstat64(struct stat64 *buf) const noexcept
 {
@@ -26,11 +26,14 @@
 #include <l4/re/rm>
 #include <l4/re/dataspace>
 #include <l4/cxx/hlist>
+#include <l4/cxx/minmax>
 #include <l4/cxx/pair>
 #include <l4/cxx/std_alloc>
 
 #include <l4/l4re_vfs/backend>
 #include <l4/re/shared_cap>
+#include <l4/sys/kip.h>
+#include <l4/sys/semaphore>
 
 #include <unistd.h>
 #include <cstdarg>
@@ -119,6 +122,8 @@ public:
 
   int alloc_fd(Ref_ptr<L4Re::Vfs::File> const &f) noexcept override;
   Ref_ptr<L4Re::Vfs::File> free_fd(int fd) noexcept override;
+  unsigned long fd_generation(int fd) noexcept override
+  { return fds.generation(fd); }
   Ref_ptr<L4Re::Vfs::File> get_root() noexcept override;
   Ref_ptr<L4Re::Vfs::File> get_cwd() noexcept override;
   void set_cwd(Ref_ptr<L4Re::Vfs::File> const &dir) noexcept override;
@@ -153,6 +158,15 @@ public:
   void *malloc(size_t size) noexcept override { return Vfs_config::malloc(size); }
   void free(void *m) noexcept override { Vfs_config::free(m); }
 
+  unsigned long io_generation() const noexcept override
+  { return __atomic_load_n(&_io_gen, __ATOMIC_SEQ_CST); }
+
+  L4::Cap<L4::Triggerable> io_notifier() noexcept override
+  { return io_sem(); }
+
+  void io_notify() noexcept override;
+  int io_wait(unsigned long gen, l4_uint64_t deadline) noexcept override;
+
 private:
   Root_mount_tree _root_mount;
   L4Re::Core::Env_dir _root;
@@ -177,12 +191,34 @@ private:
   l4_addr_t _anon_offset;
   L4Re::Shared_cap<L4Re::Dataspace> _anon_ds;
 
+  /**
+   * Semaphore for I/O readiness changes, see io_wait().
+   *
+   * Every readiness change ups the semaphore once. The waiter that gets
+   * the wakeup advances the generation and passes the wakeup on to all
+   * other waiters, these broadcast wakeups are counted in _io_bcast so
+   * that they are not passed on again.
+   */
+  l4_cap_idx_t _io_sem = L4_INVALID_CAP;
+  unsigned long _io_gen = 0;
+  unsigned _io_waiters = 0;
+  unsigned _io_bcast = 0;
+
+  L4::Cap<L4::Semaphore> io_sem() noexcept;
+
   int alloc_ds(unsigned long size, L4Re::Shared_cap<L4Re::Dataspace> *ds);
   int alloc_anon_mem(l4_umword_t size, L4Re::Shared_cap<L4Re::Dataspace> *ds,
                      l4_addr_t *offset);
 
+  int copy_anon_mem(L4::Cap<L4Re::Dataspace> dst, l4_addr_t dst_offs,
+                    L4::Cap<L4Re::Dataspace> src, L4Re::Rm::Offset src_offs,
+                    size_t len);
+
   void align_mmap_start_and_length(void **start, size_t *length);
   int munmap_regions(void *start, size_t len);
+  int protect_region(l4_addr_t start, size_t len, L4Re::Rm::Flags flags,
+                     L4::Cap<L4Re::Dataspace> ds, L4Re::Rm::Offset offs,
+                     L4Re::Rm::Flags rights);
 
   L4Re::Vfs::File_system *find_fs_from_type(char const *fstype) noexcept;
 };
@@ -585,6 +621,36 @@ Vfs::alloc_anon_mem(l4_umword_t size, L4Re::Shared_cap<L4Re::Dataspace> *ds,
   return 0;
 }
 
+int
+Vfs::copy_anon_mem(L4::Cap<L4Re::Dataspace> dst, l4_addr_t dst_offs,
+                   L4::Cap<L4Re::Dataspace> src, L4Re::Rm::Offset src_offs,
+                   size_t len)
+{
+  using namespace L4Re;
+
+  // Dataspace managers that support copy-on-write (such as Moe) only
+  // share the pages here, a page is copied on its first write fault.
+  int err = dst->copy_in(dst_offs, src, src_offs, len);
+  if (err != -L4_EINVAL)
+    return err;
+
+  L4::Cap<Rm> r = Env::env()->rm();
+  Rm::Unique_region<char*> from;
+  Rm::Unique_region<char*> to;
+  err = r->attach(&from, len, L4Re::Rm::F::Search_addr | L4Re::Rm::F::R,
+                  src, src_offs);
+  if (err < 0)
+    return err;
+
+  err = r->attach(&to, len, L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+                  dst, dst_offs);
+  if (err < 0)
+    return err;
+
+  memcpy(to.get(), from.get(), len);
+  return 0;
+}
+
 int
 Vfs::mmap2(void *start, size_t len, int prot, int flags, int fd, off_t page4k_offset,
            void **resptr) L4_NOTHROW
@@ -642,7 +708,13 @@ Vfs::mmap2(void *start, size_t len, int prot, int flags, int fd, off_t page4k_of
   l4_addr_t anon_offset = 0;
   L4Re::Rm::Flags rm_flags(0);
 
-  if (flags & (MAP_ANONYMOUS | MAP_PRIVATE))
+  // A private mapping that cannot be written never diverges from the file,
+  // so it is backed by the file's dataspace directly. Writable private
+  // mappings get anonymous memory that is populated copy-on-write from the
+  // file, see below.
+  bool const private_copy = (flags & MAP_PRIVATE) && (prot & PROT_WRITE);
+
+  if ((flags & MAP_ANONYMOUS) || private_copy)
     {
       rm_flags |= L4Re::Rm::F::Detach_free;
 
@@ -673,30 +745,16 @@ Vfs::mmap2(void *start, size_t len, int prot, int flags, int fd, off_t page4k_of
       if (len + offset > l4_round_page(fds->size()))
         return -EINVAL;
 
+      // Remember private file mappings, so that mprotect() can give them
+      // their own copy when they become writable.
       if (flags & MAP_PRIVATE)
+        rm_flags |= L4Re::Rm::F::Private;
+
+      if (private_copy)
         {
           DEBUG_LOG(debug_mmap, outstring("COW\n"););
-          int err = ds->copy_in(anon_offset, fds, offset, len);
-          if (err == -L4_EINVAL)
-            {
-              L4::Cap<Rm> r = Env::env()->rm();
-              Rm::Unique_region<char*> src;
-              Rm::Unique_region<char*> dst;
-              err = r->attach(&src, len,
-                              L4Re::Rm::F::Search_addr | L4Re::Rm::F::R,
-                              fds, offset);
-              if (err < 0)
-                return err;
-
-              err = r->attach(&dst, len,
-                              L4Re::Rm::F::Search_addr| L4Re::Rm::F::RW,
-                              ds.get(), anon_offset);
-              if (err < 0)
-                return err;
-
-              memcpy(dst.get(), src.get(), len);
-            }
-          else if (err)
+          int err = copy_anon_mem(ds.get(), anon_offset, fds, offset, len);
+          if (err)
             return err;
 
           offset = anon_offset;
@@ -739,6 +797,10 @@ Vfs::mmap2(void *start, size_t len, int prot, int flags, int fd, off_t page4k_of
 
   if (!(flags & MAP_FIXED))
     rm_flags |= Rm::F::Search_addr;
+  // files may be backed by contiguous memory that can be mapped with
+  // superpages, anonymous memory is not
+  if (!(flags & (MAP_FIXED | MAP_ANONYMOUS)) && !private_copy)
+    rm_flags |= Rm::F::Ds_aligned;
   if (prot & PROT_READ)
     rm_flags |= Rm::F::R;
   if (prot & PROT_WRITE)
@@ -815,6 +877,55 @@ namespace {
 
     ~Auto_area() { free(); }
   };
+
+  /**
+   * The part of a region, or of a hole in an area, that starts at a given
+   * address.
+   */
+  struct Mapping
+  {
+    l4_addr_t start;
+    l4_addr_t end;
+    /// Offset of `start` in `ds`, undefined for holes
+    L4Re::Rm::Offset offs;
+    /// Region flags, F::In_area for a hole in an area
+    L4Re::Rm::Flags flags;
+    L4::Cap<L4Re::Dataspace> ds;
+
+    bool is_hole() const { return bool(flags & L4Re::Rm::F::In_area); }
+
+    /**
+     * Look up the mapping at the page-aligned address `addr`.
+     *
+     * \retval 0          Success, `end` is clipped to `limit`.
+     * \retval -L4_ENOENT Nothing is attached and no area is reserved at
+     *                    `addr`.
+     */
+    int find(L4::Cap<L4Re::Rm> r, l4_addr_t addr, l4_addr_t limit)
+    {
+      l4_addr_t a = addr;
+      unsigned long s = L4_PAGESIZE;
+      int err = r->find(&a, &s, &offs, &flags, &ds);
+      if (err < 0)
+        return err;
+
+      start = addr;
+      end = cxx::min<l4_addr_t>(a + s, limit);
+
+      if (!is_hole())
+        {
+          offs += addr - a;
+          return 0;
+        }
+
+      // the hole ends at the next region attached to the area
+      L4Re::Rm::Region const *next;
+      if (r->get_regions(addr, &next) > 0 && next[0].start < end)
+        end = next[0].start;
+
+      return 0;
+    }
+  };
 }
 
 int
@@ -1001,22 +1112,381 @@ Vfs::mremap(void *old_addr, size_t old_size, size_t new_size, int flags,
   return 0;
 }
 
+int
+Vfs::protect_region(l4_addr_t start, size_t len, L4Re::Rm::Flags flags,
+                    L4::Cap<L4Re::Dataspace> ds, L4Re::Rm::Offset offs,
+                    L4Re::Rm::Flags rights)
+{
+  using namespace L4Re;
+
+  L4::Cap<Rm> r = Env::env()->rm();
+  Rm::Flags nflags = (flags & ~Rm::Flags(Rm::F::Rights_mask)) | rights;
+
+  L4Re::Shared_cap<L4Re::Dataspace> copy;
+  l4_addr_t copy_offs = 0;
+  if ((flags & Rm::F::Private) && !(flags & Rm::F::Detach_free)
+      && (rights & Rm::F::W))
+    {
+      // A private file mapping that becomes writable gets its own copy of
+      // the file contents, as if it was mapped writable in the first place.
+      int err = alloc_anon_mem(len, &copy, &copy_offs);
+      if (err)
+        return err;
+
+      err = copy_anon_mem(copy.get(), copy_offs, ds, offs, len);
+      if (err)
+        return err;
+
+      nflags |= Rm::F::Detach_free;
+    }
+  else
+    // count the reference of the re-attached region
+    L4Re::virt_cap_alloc->take(ds);
+
+  // keep the range out of reach of other attaches while it is detached
+  Auto_area area(r);
+  area.reserve(start, len, L4Re::Rm::Flags(0));
+
+  L4::Cap<L4Re::Dataspace> old_ds;
+  int err = r->detach(start, len, &old_ds, This_task,
+                      Rm::Detach_exact | Rm::Detach_keep);
+  if (err < 0)
+    {
+      if (!copy.is_valid())
+        L4Re::virt_cap_alloc->release(ds);
+      return err;
+    }
+
+  switch (err & Rm::Detach_result_mask)
+    {
+    case Rm::Split_ds:
+      // add a reference as we split up a mapping
+      if (old_ds.is_valid())
+        L4Re::virt_cap_alloc->take(old_ds);
+      break;
+    case Rm::Detached_ds:
+      if (old_ds.is_valid())
+        L4Re::virt_cap_alloc->release(old_ds);
+      break;
+    default:
+      break;
+    }
+
+  l4_addr_t a = start;
+  if (copy.is_valid())
+    {
+      err = r->attach(&a, len, Rm::F::In_area | nflags,
+                      L4::Ipc::make_cap(copy.get(), nflags.cap_rights()),
+                      copy_offs);
+      if (err < 0)
+        return err;
+
+      // release ownership of the copy, the region map is now the owner
+      copy.release();
+      return 0;
+    }
+
+  err = r->attach(&a, len, Rm::F::In_area | nflags,
+                  L4::Ipc::make_cap(ds, nflags.cap_rights()), offs);
+  if (err < 0)
+    {
+      // restore the original mapping
+      if (r->attach(&a, len, Rm::F::In_area | flags,
+                    L4::Ipc::make_cap(ds, flags.cap_rights()), offs) < 0)
+        L4Re::virt_cap_alloc->release(ds);
+      return err;
+    }
+
+  return 0;
+}
+
 int
 Vfs::mprotect(const void *a, size_t sz, int prot) L4_NOTHROW
 {
-  (void)a;
-  (void)sz;
-  return (prot & PROT_WRITE) ? -1 : 0;
+  using namespace L4Re;
+
+  l4_addr_t const start = reinterpret_cast<l4_addr_t>(a);
+  if (start & (L4_PAGESIZE - 1))
+    return -EINVAL;
+
+  l4_addr_t const end = start + l4_round_page(sz);
+  if (end < start)
+    return -ENOMEM;
+
+  Rm::Flags rights(0);
+  if (prot & PROT_READ)
+    rights |= Rm::F::R;
+  if (prot & PROT_WRITE)
+    rights |= Rm::F::W;
+  if (prot & PROT_EXEC)
+    rights |= Rm::F::X;
+
+  L4::Cap<Rm> r = Env::env()->rm();
+  Mapping m;
+
+  // Check the whole range first, so that a failing call does not leave
+  // the range partially changed.
+  for (l4_addr_t p = start; p < end; p = m.end)
+    {
+      if (m.find(r, p, end) < 0)
+        return -ENOMEM;
+
+      if (m.is_hole() || (m.flags & (Rm::F::Reserved | Rm::F::Pager)))
+        continue;
+
+      // Shared mappings can only become writable if the data space is.
+      if ((rights & Rm::F::W) && !(m.flags & Rm::F::W)
+          && !(m.flags & (Rm::F::Private | Rm::F::Detach_free))
+          && !m.ds->flags().w())
+        return -EACCES;
+    }
+
+  for (l4_addr_t p = start; p < end; p = m.end)
+    {
+      if (m.find(r, p, end) < 0)
+        return -ENOMEM;
+
+      if (m.flags & (Rm::F::Reserved | Rm::F::Pager))
+        continue;
+
+      if (m.is_hole())
+        {
+          // Commit memory to a range reserved by a PROT_NONE mmap().
+          if (rights == Rm::Flags(0))
+            continue;
+
+          l4_addr_t offs;
+          L4Re::Shared_cap<L4Re::Dataspace> ds;
+          int err = alloc_anon_mem(m.end - m.start, &ds, &offs);
+          if (err)
+            return err;
+
+          l4_addr_t ra = m.start;
+          err = r->attach(&ra, m.end - m.start,
+                          Rm::F::In_area | Rm::F::Detach_free | rights,
+                          L4::Ipc::make_cap(ds.get(), rights.cap_rights()),
+                          offs);
+          if (err < 0)
+            return err;
+
+          // release ownership of ds, the region map is now the new owner
+          ds.release();
+          continue;
+        }
+
+      if ((m.flags & Rm::F::Rights_mask) == rights)
+        continue;
+
+      int err = protect_region(m.start, m.end - m.start, m.flags, m.ds,
+                               m.offs, rights);
+      if (err < 0)
+        return err;
+    }
+
+  return 0;
+}
+
+int
+Vfs::msync(void *addr, size_t len, int flags) L4_NOTHROW
+{
+  l4_addr_t const start = reinterpret_cast<l4_addr_t>(addr);
+  if (start & (L4_PAGESIZE - 1))
+    return -EINVAL;
+
+  if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE))
+      || ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+    return -EINVAL;
+
+  // Mappings are backed by the data spaces directly, there is nothing to
+  // write back. Only check that the whole range is mapped.
+  L4::Cap<L4Re::Rm> r = L4Re::Env::env()->rm();
+  l4_addr_t const end = start + l4_round_page(len);
+  Mapping m;
+  for (l4_addr_t p = start; p < end; p = m.end)
+    if (m.find(r, p, end) < 0 || m.is_hole())
+      return -ENOMEM;
+
+  return 0;
 }
 
 int
-Vfs::msync(void *, size_t, int) L4_NOTHROW
-{ return 0; }
+Vfs::madvise(void *addr, size_t len, int advice) L4_NOTHROW
+{
+  using namespace L4Re;
+
+  l4_addr_t const start = reinterpret_cast<l4_addr_t>(addr);
+  if (start & (L4_PAGESIZE - 1))
+    return -EINVAL;
+
+  switch (advice)
+    {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+#ifdef MADV_HUGEPAGE
+    case MADV_HUGEPAGE:
+    case MADV_NOHUGEPAGE:
+#endif
+      // The page-fault path has no means to pass access-pattern hints to
+      // the data space manager.
+      return 0;
+
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+#ifdef MADV_FREE
+    case MADV_FREE:
+#endif
+      break;
+
+    default:
+      return -EINVAL;
+    }
+
+  L4::Cap<Rm> r = Env::env()->rm();
+  l4_addr_t const end = start + l4_round_page(len);
+  int res = 0;
+  Mapping m;
+  for (l4_addr_t p = start; p < end; p = m.end)
+    {
+      if (m.find(r, p, end) < 0)
+        return -ENOMEM;
+
+      if (m.is_hole())
+        {
+          // like Linux, still apply the advice to the mapped parts
+          res = -ENOMEM;
+          continue;
+        }
+
+      if (m.flags & (Rm::F::Reserved | Rm::F::Pager))
+        continue;
+
+      if (advice == MADV_WILLNEED)
+        {
+          // failing to allocate ahead of time is not fatal for a hint
+          if (m.ds->allocate(m.offs, m.end - m.start) == -L4_ENOMEM)
+            res = -EAGAIN;
+          continue;
+        }
+
+      // Only anonymous memory is given back, it reads as zeros afterwards.
+      // Shared mappings and private mappings that still use the file's
+      // dataspace directly keep their contents.
+      if (!(m.flags & Rm::F::Detach_free))
+        continue;
+
+      // The private copy of a file mapping would have to be refetched from
+      // the file, which the region no longer refers to.
+      if (m.flags & Rm::F::Private)
+        return -EINVAL;
+
+      int err = m.ds->clear(m.offs, m.end - m.start);
+      if (err < 0)
+        return err;
+    }
+
+  return res;
+}
+
+}
+
+L4::Cap<L4::Semaphore>
+Vfs::io_sem() noexcept
+{
+  l4_cap_idx_t c = __atomic_load_n(&_io_sem, __ATOMIC_ACQUIRE);
+  if (l4_is_valid_cap(c))
+    return L4::Cap<L4::Semaphore>(c);
+
+  auto s = L4Re::virt_cap_alloc->alloc<L4::Semaphore>();
+  if (!s.is_valid())
+    return s;
+
+  if (l4_error(L4Re::Env::env()->factory()->create(s)) < 0)
+    {
+      L4Re::virt_cap_alloc->free(s);
+      return L4::Cap<L4::Semaphore>::Invalid;
+    }
+
+  // another thread may have been faster
+  if (!__atomic_compare_exchange_n(&_io_sem, &c, s.cap(), false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      L4Re::virt_cap_alloc->free(s, L4Re::This_task);
+      return L4::Cap<L4::Semaphore>(c);
+    }
+
+  return s;
+}
+
+void
+Vfs::io_notify() noexcept
+{
+  L4::Cap<L4::Semaphore> sem = io_sem();
+
+  __atomic_add_fetch(&_io_gen, 1, __ATOMIC_SEQ_CST);
+  if (sem.is_valid())
+    sem->up();
+}
 
 int
-Vfs::madvise(void *, size_t, int) L4_NOTHROW
-{ return 0; }
+Vfs::io_wait(unsigned long gen, l4_uint64_t deadline) noexcept
+{
+  L4::Cap<L4::Semaphore> sem = io_sem();
+  if (!sem.is_valid())
+    return -ENOMEM;
+
+  l4_timeout_t to = L4_IPC_NEVER;
+  if (deadline != ~0ULL)
+    {
+      l4_uint64_t now = l4_kip_clock(l4re_kip());
+      if (now >= deadline)
+        return -ETIMEDOUT;
+
+      // Longer waits return early, the caller just rechecks its files.
+      l4_uint64_t us = cxx::min<l4_uint64_t>(deadline - now,
+                                             L4_TIMEOUT_US_MAX);
+      to = l4_timeout(L4_IPC_TIMEOUT_0, l4_timeout_from_us(us));
+    }
+
+  // Registering as a waiter before checking the generation pairs with the
+  // broadcast below, which advances the generation before it counts the
+  // waiters: a thread that misses the broadcast sees the new generation.
+  __atomic_add_fetch(&_io_waiters, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&_io_gen, __ATOMIC_SEQ_CST) != gen)
+    {
+      __atomic_sub_fetch(&_io_waiters, 1, __ATOMIC_SEQ_CST);
+      return 0;
+    }
 
+  int err = l4_error(sem->down(to));
+  __atomic_sub_fetch(&_io_waiters, 1, __ATOMIC_SEQ_CST);
+
+  if (err == -(L4_EIPC_LO + L4_IPC_RECANCELED))
+    return -EINTR;
+
+  if (err < 0)
+    {
+      if (deadline != ~0ULL && l4_kip_clock(l4re_kip()) >= deadline)
+        return -ETIMEDOUT;
+      return 0;
+    }
+
+  // do not pass on a wakeup that came from another waiter
+  unsigned b = __atomic_load_n(&_io_bcast, __ATOMIC_SEQ_CST);
+  while (b && !__atomic_compare_exchange_n(&_io_bcast, &b, b - 1, false,
+                                           __ATOMIC_SEQ_CST,
+                                           __ATOMIC_SEQ_CST))
+    ;
+  if (b)
+    return 0;
+
+  __atomic_add_fetch(&_io_gen, 1, __ATOMIC_SEQ_CST);
+  unsigned others = __atomic_load_n(&_io_waiters, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&_io_bcast, others, __ATOMIC_SEQ_CST);
+  for (unsigned i = 0; i < others; ++i)
+    sem->up();
+
+  return 0;
 }
 
 L4Re::Vfs::Ops *__rtld_l4re_env_posix_vfs_ops;
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <utime.h>
 #include <errno.h>
 
@@ -36,6 +37,7 @@
 #ifdef __cplusplus
 
 #include <l4/sys/capability>
+#include <l4/sys/irq>
 #include <l4/re/cap_alloc>
 #include <l4/re/dataspace>
 #include <l4/cxx/pair>
@@ -413,6 +415,22 @@ public:
    * \return >=0 on success, or <0 on error.
    */
   virtual int ioctl(unsigned long cmd, va_list args) noexcept = 0;
+
+  /**
+   * \brief Get the I/O readiness of the file.
+   *
+   * Backend for POSIX poll, select and epoll.
+   *
+   * \param events  Events of interest, a combination of POLLIN, POLLPRI and
+   *                POLLOUT.
+   * \return The ready events out of `events`, plus POLLERR and POLLHUP if
+   *         these conditions are present.
+   *
+   * This function must not block. Files whose readiness changes
+   * asynchronously must signal the change with Io_wait::io_notify(), or
+   * bind the notification of their server to Io_wait::io_notifier().
+   */
+  virtual short poll_events(short events) noexcept = 0;
 };
 
 inline
@@ -960,6 +978,17 @@ public:
    */
   virtual cxx::Ref_ptr<File> free_fd(int fd) noexcept = 0;
 
+  /**
+   * \brief Get the generation of the file descriptor \a fd.
+   * \param fd The file descriptor.
+   * \return A value that changes whenever \a fd is assigned or freed.
+   *
+   * Together with the file descriptor the generation identifies an open
+   * file, even if the file descriptor is reused for a new file object at
+   * the same address.
+   */
+  virtual unsigned long fd_generation(int fd) noexcept = 0;
+
   /**
    * \brief Mount a given file object at the given global path in the VFS.
    * \param path The global path to mount \a dir at.
@@ -1071,13 +1100,76 @@ inline
 Fs::~Fs()
 {}
 
+/**
+ * \brief Interface for waiting for the I/O readiness of files.
+ * \note This interface usually exists as a singleton and as a superclass
+ *       of L4Re::Vfs::Ops.
+ *
+ * All files signal changes of their readiness through a single notifier.
+ * Waiting threads recheck their files (File::poll_events()) whenever the
+ * notifier fired, so a single thread can wait for any number of files.
+ * The usual pattern is:
+ *
+ *     for (;;)
+ *       {
+ *         unsigned long gen = vfs_ops->io_generation();
+ *         if (any file ready)
+ *           break;
+ *         if (vfs_ops->io_wait(gen, deadline) < 0)
+ *           break;
+ *       }
+ */
+class Io_wait
+{
+public:
+  /**
+   * Get the current I/O generation.
+   *
+   * The generation changes with every readiness change signalled through
+   * the notifier.
+   */
+  virtual unsigned long io_generation() const noexcept = 0;
+
+  /**
+   * Get the notifier of the I/O readiness changes.
+   *
+   * Files bind the notification of their server, for example the IRQ of a
+   * L4::Vcon, to this object.
+   */
+  virtual L4::Cap<L4::Triggerable> io_notifier() noexcept = 0;
+
+  /// Signal an I/O readiness change to all waiting threads.
+  virtual void io_notify() noexcept = 0;
+
+  /**
+   * Wait for an I/O readiness change.
+   *
+   * \param gen       I/O generation taken before checking the readiness of
+   *                  the files.
+   * \param deadline  Absolute timeout in microseconds of the KIP clock,
+   *                  ~0ULL for no timeout.
+   *
+   * \retval 0           The readiness of files may have changed since
+   *                     `gen`, also returned for spurious wakeups.
+   * \retval -ETIMEDOUT  The deadline passed.
+   * \retval <0          Other error.
+   */
+  virtual int io_wait(unsigned long gen, l4_uint64_t deadline) noexcept = 0;
+
+  virtual ~Io_wait() noexcept = 0;
+};
+
+inline
+Io_wait::~Io_wait() noexcept
+{}
+
 /**
  * \brief Interface for the POSIX backends of an application.
  * \note There usually exists a singe instance of this interface
  *       available via L4Re::Vfs::vfs_ops that is used for all
  *       kinds of C-Library functions.
  */
-class Ops : public Mman, public Fs
+class Ops : public Mman, public Fs, public Io_wait
 {
 public:
   virtual void *malloc(size_t bytes) noexcept = 0;
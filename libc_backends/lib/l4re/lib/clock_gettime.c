@@ -12,6 +12,7 @@
 #include <time.h>
 #include <l4/re/env.h>
 #include <l4/sys/kip.h>
+#include <l4/sys/thread.h>
 #include <l4/libc_backends/clk.h>
 
 #include "clocks.h"
@@ -19,39 +20,131 @@
 typedef int Get_clock(struct timespec *);
 uint64_t __attribute__((weak)) __libc_l4_rt_clock_offset;
 
+/*
+ * Provided by libpthread, if the program uses it. Declared here as every
+ * program links this library, a pthread_t is a pointer.
+ */
+void *pthread_self(void) __attribute__((weak));
+l4_cap_idx_t pthread_l4_cap(void *t) __attribute__((weak));
+void pthread_l4_for_each_thread(void (*fn)(void *)) __attribute__((weak));
+unsigned long
+pthread_l4_exited_threads_time(l4_kernel_clock_t *us) __attribute__((weak));
+
+static void ns_to_timespec(uint64_t ns, struct timespec *tp)
+{
+  tp->tv_sec  = ns / 1000000000;
+  tp->tv_nsec = ns % 1000000000;
+}
+
+/*
+ * The KIP code for reading the clock in nanoseconds runs at user level, it
+ * interpolates between the kernel clock updates with the calibrated CPU
+ * counter where the platform has one.
+ */
 int __attribute__((weak))
 libc_backend_rt_clock_gettime(struct timespec *tp)
 {
   uint64_t clock;
 
-  clock = l4_kip_clock(l4re_kip());
-  clock += __libc_l4_rt_clock_offset;
-
-  tp->tv_sec  = clock / 1000000;
-  tp->tv_nsec = (clock % 1000000) * 1000;
+  clock = l4_kip_clock_ns(l4re_kip());
+  clock += __libc_l4_rt_clock_offset * 1000;
 
+  ns_to_timespec(clock, tp);
   return 0;
 }
 
 static int mono_clock_gettime(struct timespec *tp)
 {
-  uint64_t clock;
-  clock = l4_kip_clock(l4re_kip());
-  tp->tv_sec = clock / 1000000;
-  tp->tv_nsec = (clock % 1000000) * 1000;
+  ns_to_timespec(l4_kip_clock_ns(l4re_kip()), tp);
+  return 0;
+}
+
+static l4_cap_idx_t self_thread(void)
+{
+  /* without libpthread the program has only its initial thread */
+  if (!pthread_l4_cap)
+    return L4_BASE_THREAD_CAP;
+
+  return pthread_l4_cap(pthread_self());
+}
+
+static int thread_time(l4_cap_idx_t thread, uint64_t *ns)
+{
+  l4_kernel_clock_t us;
+  if (l4_error(l4_thread_stats_time(thread, &us)) < 0)
+    return -1;
+
+  *ns = us * 1000;
+  return 0;
+}
 
+static int thread_cputime_gettime(struct timespec *tp)
+{
+  uint64_t ns;
+  if (thread_time(self_thread(), &ns) < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  ns_to_timespec(ns, tp);
   return 0;
 }
 
-Get_clock *__libc_l4_gettime[4] =
+/* The threads are iterated by the pthread manager thread. */
+static int process_time_lock;
+static uint64_t process_time;
+
+static void add_thread_time(void *t)
 {
-  [CLOCK_REALTIME]  = libc_backend_rt_clock_gettime,
-  [CLOCK_MONOTONIC] = mono_clock_gettime
+  uint64_t ns;
+  if (thread_time(pthread_l4_cap(t), &ns) == 0)
+    process_time += ns;
+}
+
+static int process_cputime_gettime(struct timespec *tp)
+{
+  uint64_t ns;
+  unsigned long exits;
+  l4_kernel_clock_t exited;
+
+  if (!pthread_l4_for_each_thread || !pthread_l4_cap
+      || !pthread_l4_exited_threads_time)
+    return thread_cputime_gettime(tp);
+
+  while (__atomic_exchange_n(&process_time_lock, 1, __ATOMIC_ACQUIRE))
+    l4_thread_yield();
+
+  /* a thread exiting during the iteration would be counted twice or not */
+  do
+    {
+      exits = pthread_l4_exited_threads_time(&exited);
+      process_time = exited * 1000;
+      pthread_l4_for_each_thread(add_thread_time);
+    }
+  while (exits != pthread_l4_exited_threads_time(&exited));
+  ns = process_time;
+
+  __atomic_store_n(&process_time_lock, 0, __ATOMIC_RELEASE);
+
+  ns_to_timespec(ns, tp);
+  return 0;
+}
+
+Get_clock *__libc_l4_gettime[NCLOCKS] =
+{
+  [CLOCK_REALTIME]           = libc_backend_rt_clock_gettime,
+  [CLOCK_MONOTONIC]          = mono_clock_gettime,
+  [CLOCK_PROCESS_CPUTIME_ID] = process_cputime_gettime,
+  [CLOCK_THREAD_CPUTIME_ID]  = thread_cputime_gettime,
+  /* the clock is never slewed and the system is never suspended */
+  [CLOCK_MONOTONIC_RAW]      = mono_clock_gettime,
+  [CLOCK_BOOTTIME]           = mono_clock_gettime,
 };
 
 int clock_gettime(clockid_t clk_id, struct timespec *tp)
 {
-  if (clk_id >= NCLOCKS || !__libc_l4_gettime[clk_id])
+  if (clk_id < 0 || clk_id >= NCLOCKS || !__libc_l4_gettime[clk_id])
     {
       errno = ENODEV;
       return -1;
@@ -59,4 +152,3 @@ int clock_gettime(clockid_t clk_id, struct timespec *tp)
 
   return __libc_l4_gettime[clk_id](tp);
 }
-
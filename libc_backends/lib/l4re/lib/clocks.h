@@ -7,4 +7,4 @@
  */
 #pragma once
 
-enum { NCLOCKS = 4 };
+enum { NCLOCKS = 8 };
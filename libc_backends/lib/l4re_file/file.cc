@@ -536,29 +536,6 @@ L4B_REDIRECT_4(int, utimensat, int, const char *,
 
 // ------------------------------------------------------
 
-//#include <stdio.h>
-#include <l4/util/util.h>
-
-int select(int nfds, fd_set *readfds, fd_set *writefds,
-           fd_set *exceptfds, struct timeval *timeout)
-{
-  (void)nfds; (void)readfds; (void)writefds; (void)exceptfds;
-  //printf("Call: %s(%d, %p, %p, %p, %p[%ld])\n", __func__, nfds, readfds, writefds, exceptfds, timeout, timeout->tv_usec + timeout->tv_sec * 1000000);
-
-#if 0
-  int us = timeout->tv_usec + timeout->tv_sec * 1000000;
-  l4_timeout_t to = l4_timeout(L4_IPC_TIMEOUT_NEVER, l4_timeout_from_us(us));
-#endif
-
-  // only the timeout for now
-  if (timeout)
-    l4_usleep(timeout->tv_usec + timeout->tv_sec * 1000000);
-  else
-    l4_sleep_forever();
-
-  return 0;
-}
-
 #undef L4B_REDIRECT
 
 #define L4B_REDIRECT(ret, func, ptlist, plist) \
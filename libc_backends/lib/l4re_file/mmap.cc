@@ -12,6 +12,7 @@
 #include <l4/re/dataspace>
 #include <l4/re/env>
 #include <l4/re/util/cap_alloc>
+#include <l4/cxx/minmax>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cstdio>
@@ -92,23 +93,46 @@ noexcept(noexcept(mremap(old_addr, old_size, new_size, flags)))
   return resptr;
 }
 
+// The heap is made of contiguous segments of anonymous memory. A segment
+// grows in place as long as the address space behind its end is free,
+// otherwise the heap continues with a new segment. Only the latest segment
+// can shrink again.
+static char *current_morecore_start;
 static void *current_morecore_end;
 
 void *uclibc_morecore(long bytes)
 {
   // calling morecore with 0 size is done by the malloc implementation
   // to check for the amount of memory it got from the last call to morecore
-  // With a negative value, 'free' wants to return memory, we do not support
-  // that here.
-  if (bytes <= 0)
+  if (bytes == 0)
     return current_morecore_end;
 
+  char *end = static_cast<char *>(current_morecore_end);
+
+  // With a negative value, 'free' wants to return memory from the top of
+  // the heap. Unmapping the anonymous memory also frees its backing.
+  if (bytes < 0)
+    {
+      unsigned long s = cxx::min<unsigned long>(l4_trunc_page(-bytes),
+                                                end - current_morecore_start);
+      if (s && munmap(end - s, s) == 0)
+        current_morecore_end = end - s;
+
+      return end;
+    }
+
   size_t s = l4_round_page(bytes);
-  void *b = mmap2(0, s, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, 0, 0);
+  void *b = mmap2(end, s, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, 0, 0);
+  // the search only goes upwards from the hint, try the whole address
+  // space before giving up
+  if (L4_UNLIKELY(b == MAP_FAILED) && end)
+    b = mmap2(0, s, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, 0, 0);
   if (L4_UNLIKELY(b == MAP_FAILED))
     return b;
 
+  if (b != end)
+    current_morecore_start = static_cast<char *>(b);
+
   current_morecore_end = static_cast<char *>(b) + s;
   return b;
 }
-
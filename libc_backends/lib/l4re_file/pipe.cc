@@ -0,0 +1,671 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+
+/*
+ * pipe(), pipe2() and socketpair() within a task.
+ *
+ * Every direction of a pipe is a ring in anonymous memory. Reader and
+ * writer each own one index of the ring, so they exchange data without
+ * a lock; concurrent readers or concurrent writers of the same end
+ * serialize on a spin lock. Data is copied exactly once, from the buffers
+ * of the writer into the ring and from the ring into the buffers of the
+ * reader.
+ *
+ * Blocked readers and writers, as well as poll(), wait for the I/O
+ * notifier of the VFS (Io_wait). A side that found the ring empty or full
+ * arms the ring, the other side signals the notifier only if the ring was
+ * armed, so the data path does not need a system call as long as nobody
+ * waits.
+ */
+#include <features.h>
+
+#include <l4/l4re_vfs/backend>
+#include <l4/cxx/minmax>
+#include <l4/sys/thread.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace L4Re::Vfs;
+using cxx::Ref_ptr;
+
+#define ERRNO_RET(r) do { \
+  if ((r) < 0) \
+    {          \
+      errno = -(r); \
+      return -1; \
+    } } while (0)
+
+namespace {
+
+enum : l4_uint64_t { Forever = ~0ULL };
+
+/**
+ * One direction of a pipe.
+ *
+ * The ring is shared by the file of the reading end and the file of the
+ * writing end and freed when both are gone.
+ */
+class Pipe_ring
+{
+public:
+  enum : unsigned { Size = 64 << 10 };
+
+  static Pipe_ring *create() noexcept
+  {
+    void *d = mmap(0, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (d == MAP_FAILED)
+      return 0;
+
+    void *m = malloc(sizeof(Pipe_ring));
+    if (!m)
+      {
+        munmap(d, Size);
+        return 0;
+      }
+
+    return new (m) Pipe_ring(static_cast<char *>(d));
+  }
+
+  /// Another end refers to the ring.
+  void get() noexcept
+  { __atomic_add_fetch(&_refs, 1, __ATOMIC_RELAXED); }
+
+  /// An end is gone, free the ring with the last one.
+  void put() noexcept
+  {
+    if (__atomic_sub_fetch(&_refs, 1, __ATOMIC_ACQ_REL))
+      return;
+
+    munmap(_data, Size);
+    this->~Pipe_ring();
+    free(this);
+  }
+
+  /// Bytes that can be read.
+  unsigned readable() const noexcept
+  {
+    return __atomic_load_n(&_head, __ATOMIC_SEQ_CST)
+           - __atomic_load_n(&_tail, __ATOMIC_SEQ_CST);
+  }
+
+  /// Bytes that can be written.
+  unsigned writable() const noexcept
+  { return Size - readable(); }
+
+  bool reader_closed() const noexcept
+  { return __atomic_load_n(&_rd_closed, __ATOMIC_SEQ_CST); }
+
+  bool writer_closed() const noexcept
+  { return __atomic_load_n(&_wr_closed, __ATOMIC_SEQ_CST); }
+
+  /// Ask the writer to signal new data.
+  void arm_reader() noexcept
+  { __atomic_store_n(&_rd_armed, 1, __ATOMIC_SEQ_CST); }
+
+  /// Ask the reader to signal free space.
+  void arm_writer() noexcept
+  { __atomic_store_n(&_wr_armed, 1, __ATOMIC_SEQ_CST); }
+
+  void close_reader() noexcept
+  {
+    __atomic_store_n(&_rd_closed, true, __ATOMIC_SEQ_CST);
+    vfs_ops->io_notify();
+  }
+
+  void close_writer() noexcept
+  {
+    __atomic_store_n(&_wr_closed, true, __ATOMIC_SEQ_CST);
+    vfs_ops->io_notify();
+  }
+
+  ssize_t read(const struct iovec *iov, int iovcnt) noexcept;
+  ssize_t write(const struct iovec *iov, int iovcnt, size_t skip) noexcept;
+
+private:
+  explicit Pipe_ring(char *data) noexcept : _data(data) {}
+
+  static void lock(int *l) noexcept
+  {
+    while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE))
+      l4_thread_yield();
+  }
+
+  static void unlock(int *l) noexcept
+  { __atomic_store_n(l, 0, __ATOMIC_RELEASE); }
+
+  static void signal(int *armed) noexcept
+  {
+    if (__atomic_exchange_n(armed, 0, __ATOMIC_SEQ_CST))
+      vfs_ops->io_notify();
+  }
+
+  char *const _data;
+  int _refs = 1;
+
+  /// Written by the writer only.
+  unsigned _head = 0;
+  /// Written by the reader only.
+  unsigned _tail = 0;
+
+  bool _rd_closed = false;
+  bool _wr_closed = false;
+  int _rd_armed = 0;
+  int _wr_armed = 0;
+  int _rd_lock = 0;
+  int _wr_lock = 0;
+};
+
+/**
+ * Move data out of the ring without blocking.
+ *
+ * \retval >0      Number of bytes read.
+ * \retval 0       The ring is empty and the writing end is closed, or the
+ *                 reading end is closed.
+ * \retval -EAGAIN The ring is empty.
+ */
+ssize_t
+Pipe_ring::read(const struct iovec *iov, int iovcnt) noexcept
+{
+  if (reader_closed())
+    return 0;
+
+  lock(&_rd_lock);
+
+  // check for the closed writer first, data written before is still read
+  bool eof = writer_closed();
+  unsigned tail = _tail;
+  unsigned avail = __atomic_load_n(&_head, __ATOMIC_SEQ_CST) - tail;
+  if (!avail)
+    {
+      unlock(&_rd_lock);
+      return eof ? 0 : -EAGAIN;
+    }
+
+  ssize_t bytes = 0;
+  for (; iovcnt > 0 && avail; --iovcnt, ++iov)
+    {
+      char *buf = static_cast<char *>(iov->iov_base);
+      size_t len = cxx::min<size_t>(iov->iov_len, avail);
+      avail -= len;
+      bytes += len;
+
+      while (len)
+        {
+          unsigned offs = tail & (Size - 1);
+          unsigned n = cxx::min<size_t>(len, Size - offs);
+          memcpy(buf, _data + offs, n);
+          buf += n;
+          tail += n;
+          len -= n;
+        }
+    }
+
+  __atomic_store_n(&_tail, tail, __ATOMIC_SEQ_CST);
+  unlock(&_rd_lock);
+
+  signal(&_wr_armed);
+  return bytes;
+}
+
+/**
+ * Move data into the ring without blocking.
+ *
+ * \param skip  Number of bytes at the start of `iov` that were already
+ *              written.
+ *
+ * Writes of up to PIPE_BUF bytes are atomic, they are written completely
+ * or not at all.
+ *
+ * \retval >0      Number of bytes written.
+ * \retval 0       Nothing left to write.
+ * \retval -EAGAIN There is not enough room in the ring.
+ * \retval -EPIPE  The reading end is closed.
+ */
+ssize_t
+Pipe_ring::write(const struct iovec *iov, int iovcnt, size_t skip) noexcept
+{
+  for (; iovcnt > 0 && skip >= iov->iov_len; --iovcnt, ++iov)
+    skip -= iov->iov_len;
+
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    total += iov[i].iov_len;
+  total -= skip;
+
+  if (!total)
+    return 0;
+
+  lock(&_wr_lock);
+
+  if (reader_closed())
+    {
+      unlock(&_wr_lock);
+      return -EPIPE;
+    }
+
+  unsigned head = _head;
+  unsigned space = Size - (head - __atomic_load_n(&_tail, __ATOMIC_SEQ_CST));
+  if (!space || (total <= PIPE_BUF && space < total))
+    {
+      unlock(&_wr_lock);
+      return -EAGAIN;
+    }
+
+  ssize_t bytes = 0;
+  for (; iovcnt > 0 && space; --iovcnt, ++iov, skip = 0)
+    {
+      char const *buf = static_cast<char const *>(iov->iov_base) + skip;
+      size_t len = cxx::min<size_t>(iov->iov_len - skip, space);
+      space -= len;
+      bytes += len;
+
+      while (len)
+        {
+          unsigned offs = head & (Size - 1);
+          unsigned n = cxx::min<size_t>(len, Size - offs);
+          memcpy(_data + offs, buf, n);
+          buf += n;
+          head += n;
+          len -= n;
+        }
+    }
+
+  __atomic_store_n(&_head, head, __ATOMIC_SEQ_CST);
+  unlock(&_wr_lock);
+
+  signal(&_rd_armed);
+  return bytes;
+}
+
+/**
+ * An end of a pipe or a socket pair.
+ *
+ * The end of a pipe has either a ring to read from or a ring to write to,
+ * the end of a socket pair has both.
+ */
+class Pipe_file : public Be_file_stream
+{
+public:
+  Pipe_file(Pipe_ring *rd, Pipe_ring *wr, bool socket, int flags) noexcept
+  : _rd(rd), _wr(wr), _socket(socket), _nonblock(flags & O_NONBLOCK)
+  {
+    if (_rd)
+      _rd->get();
+    if (_wr)
+      _wr->get();
+  }
+
+  ~Pipe_file() noexcept
+  {
+    shutdown(SHUT_RDWR);
+  }
+
+  ssize_t readv(const struct iovec *iov, int iovcnt) noexcept override;
+  ssize_t writev(const struct iovec *iov, int iovcnt) noexcept override;
+  short poll_events(short events) noexcept override;
+  int ioctl(unsigned long request, va_list args) noexcept override;
+
+  int fstat64(struct stat64 *buf) const noexcept override
+  {
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = (_socket ? S_IFSOCK : S_IFIFO) | S_IRUSR | S_IWUSR;
+    buf->st_blksize = PIPE_BUF;
+    return 0;
+  }
+
+  int get_status_flags() const noexcept override
+  {
+    int flags = _nonblock ? O_NONBLOCK : 0;
+    if (_socket)
+      return flags | O_RDWR;
+    return flags | (_rd ? O_RDONLY : O_WRONLY);
+  }
+
+  int set_status_flags(long flags) noexcept override
+  {
+    _nonblock = flags & O_NONBLOCK;
+    return 0;
+  }
+
+  // Socket interface, only for the ends of socket pairs
+  ssize_t send(void const *buf, size_t len, int flags) noexcept override
+  {
+    if (!_socket)
+      return -ENOTSOCK;
+
+    struct iovec iov = { const_cast<void *>(buf), len };
+    return transfer(&iov, 1, flags, true);
+  }
+
+  ssize_t recv(void *buf, size_t len, int flags) noexcept override
+  {
+    if (!_socket)
+      return -ENOTSOCK;
+
+    struct iovec iov = { buf, len };
+    return transfer(&iov, 1, flags, false);
+  }
+
+  ssize_t sendto(void const *buf, size_t len, int flags,
+                 sockaddr const *, socklen_t) noexcept override
+  { return send(buf, len, flags); }
+
+  ssize_t recvfrom(void *buf, size_t len, int flags,
+                   sockaddr *, socklen_t *addrlen) noexcept override
+  {
+    if (addrlen)
+      *addrlen = 0;
+    return recv(buf, len, flags);
+  }
+
+  ssize_t sendmsg(msghdr const *msg, int flags) noexcept override
+  {
+    if (!_socket)
+      return -ENOTSOCK;
+    return transfer(msg->msg_iov, msg->msg_iovlen, flags, true);
+  }
+
+  ssize_t recvmsg(msghdr *msg, int flags) noexcept override
+  {
+    if (!_socket)
+      return -ENOTSOCK;
+
+    msg->msg_namelen = 0;
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+    return transfer(msg->msg_iov, msg->msg_iovlen, flags, false);
+  }
+
+  int shutdown(int how) noexcept override
+  {
+    if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR)
+      return -EINVAL;
+
+    lock();
+    Pipe_ring *rd = how != SHUT_WR ? _rd : 0;
+    Pipe_ring *wr = how != SHUT_RD ? _wr : 0;
+    if (rd)
+      _rd = 0;
+    if (wr)
+      _wr = 0;
+    unlock();
+
+    // threads still using the rings hold their own references
+    if (rd)
+      {
+        rd->close_reader();
+        rd->put();
+      }
+
+    if (wr)
+      {
+        wr->close_writer();
+        wr->put();
+      }
+
+    return 0;
+  }
+
+private:
+  ssize_t transfer(const struct iovec *iov, int iovcnt, int flags,
+                   bool out) noexcept;
+
+  /// Get a reference to a ring, shutdown() may drop the one of the file.
+  Pipe_ring *ring(bool out) noexcept
+  {
+    lock();
+    Pipe_ring *r = out ? _wr : _rd;
+    if (r)
+      r->get();
+    unlock();
+    return r;
+  }
+
+  void lock() noexcept
+  {
+    while (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE))
+      l4_thread_yield();
+  }
+
+  void unlock() noexcept
+  { __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE); }
+
+  Pipe_ring *_rd;
+  Pipe_ring *_wr;
+  bool const _socket;
+  bool _nonblock;
+  int _lock = 0;
+};
+
+/**
+ * Read or write, wait for the ring if the file is blocking.
+ *
+ * Blocking writes return when everything is written, like on Linux.
+ */
+ssize_t
+Pipe_file::transfer(const struct iovec *iov, int iovcnt, int flags,
+                    bool out) noexcept
+{
+  if (iovcnt < 0)
+    return -EINVAL;
+
+  Pipe_ring *r = ring(out);
+  if (!r)
+    {
+      if (out)
+        return _socket ? -EPIPE : -EBADF;
+      // reading from a socket that was shut down for reading
+      return _socket ? 0 : -EBADF;
+    }
+
+  bool nonblock = _nonblock || (flags & MSG_DONTWAIT);
+  ssize_t bytes = 0;
+  unsigned long gen = 0;
+  bool armed = false;
+  for (;;)
+    {
+      ssize_t ret = out ? r->write(iov, iovcnt, bytes) : r->read(iov, iovcnt);
+      if (ret > 0)
+        {
+          bytes += ret;
+          armed = false;
+          if (!out || nonblock)
+            break;
+          continue;
+        }
+
+      if (ret != -EAGAIN || nonblock)
+        {
+          if (!bytes)
+            bytes = ret;
+          break;
+        }
+
+      if (!armed)
+        {
+          // taken before the ring is armed to not miss the notification,
+          // the ring is checked again before waiting
+          gen = vfs_ops->io_generation();
+          if (out)
+            r->arm_writer();
+          else
+            r->arm_reader();
+          armed = true;
+          continue;
+        }
+
+      int err = vfs_ops->io_wait(gen, Forever);
+      armed = false;
+      if (err < 0)
+        {
+          if (!bytes)
+            bytes = err;
+          break;
+        }
+    }
+
+  r->put();
+  return bytes;
+}
+
+ssize_t
+Pipe_file::readv(const struct iovec *iov, int iovcnt) noexcept
+{ return transfer(iov, iovcnt, 0, false); }
+
+ssize_t
+Pipe_file::writev(const struct iovec *iov, int iovcnt) noexcept
+{ return transfer(iov, iovcnt, 0, true); }
+
+short
+Pipe_file::poll_events(short events) noexcept
+{
+  short ready = 0;
+
+  if (Pipe_ring *rd = ring(false))
+    {
+      // arm the ring only when the caller may wait for it
+      if (!rd->readable() && (events & POLLIN))
+        rd->arm_reader();
+
+      if (rd->readable())
+        ready |= POLLIN;
+      else if (rd->writer_closed())
+        ready |= POLLHUP;
+      rd->put();
+    }
+
+  if (Pipe_ring *wr = ring(true))
+    {
+      if (wr->writable() < PIPE_BUF && (events & POLLOUT))
+        wr->arm_writer();
+
+      if (wr->reader_closed())
+        ready |= POLLERR;
+      else if (wr->writable() >= PIPE_BUF)
+        ready |= POLLOUT;
+      wr->put();
+    }
+
+  return ready & (events | POLLERR | POLLHUP);
+}
+
+int
+Pipe_file::ioctl(unsigned long request, va_list args) noexcept
+{
+  switch (request)
+    {
+    case FIONREAD:
+      {
+        int *avail = va_arg(args, int *);
+        *avail = 0;
+        if (Pipe_ring *rd = ring(false))
+          {
+            *avail = rd->readable();
+            rd->put();
+          }
+        return 0;
+      }
+    case FIONBIO:
+      _nonblock = *va_arg(args, int *);
+      return 0;
+    default:
+      return -EINVAL;
+    }
+}
+
+/**
+ * Create the files for two ends and put them into `fds`.
+ */
+int
+make_pair(Pipe_ring *a, Pipe_ring *b, bool socket, int flags,
+          int fds[2]) noexcept
+{
+  // a pipe reads from `a` at fds[0] and writes to it at fds[1]
+  Ref_ptr<File> f0(new Pipe_file(a, socket ? b : 0, socket, flags));
+  Ref_ptr<File> f1(new Pipe_file(socket ? b : 0, a, socket, flags));
+  if (!f0 || !f1)
+    return -ENOMEM;
+
+  int fd0 = vfs_ops->alloc_fd(f0);
+  if (fd0 < 0)
+    return fd0;
+
+  int fd1 = vfs_ops->alloc_fd(f1);
+  if (fd1 < 0)
+    {
+      vfs_ops->free_fd(fd0);
+      return fd1;
+    }
+
+  fds[0] = fd0;
+  fds[1] = fd1;
+  return 0;
+}
+
+int
+create_pair(bool socket, int flags, int fds[2]) noexcept
+{
+  Pipe_ring *a = Pipe_ring::create();
+  Pipe_ring *b = socket ? Pipe_ring::create() : 0;
+
+  int err = (!a || (socket && !b)) ? -ENOMEM
+                                   : make_pair(a, b, socket, flags, fds);
+
+  // the files hold their own references
+  if (a)
+    a->put();
+  if (b)
+    b->put();
+
+  return err;
+}
+
+}
+
+int
+pipe2(int pipefd[2], int flags) noexcept
+{
+  if (flags & ~(O_NONBLOCK | O_CLOEXEC))
+    ERRNO_RET(-EINVAL);
+
+  // close-on-exec has no meaning, programs are never exec'd in place
+  int err = create_pair(false, flags, pipefd);
+  ERRNO_RET(err);
+  return 0;
+}
+
+int
+pipe(int pipefd[2]) noexcept
+{
+  return pipe2(pipefd, 0);
+}
+
+int
+socketpair(int domain, int type, int protocol, int sv[2]) noexcept
+{
+  if (domain != AF_UNIX)
+    ERRNO_RET(-EAFNOSUPPORT);
+
+  if (protocol != 0)
+    ERRNO_RET(-EPROTONOSUPPORT);
+
+  if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != SOCK_STREAM)
+    ERRNO_RET(-EOPNOTSUPP);
+
+  int err = create_pair(true, (type & SOCK_NONBLOCK) ? O_NONBLOCK : 0, sv);
+  ERRNO_RET(err);
+  return 0;
+}
@@ -0,0 +1,651 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+
+/*
+ * Readiness-based poll(), select() and epoll on top of the files of the VFS.
+ *
+ * All functions follow the same pattern: take the I/O generation, check the
+ * readiness of all files with File::poll_events() and, if nothing is ready,
+ * wait until the VFS signals a readiness change (Io_wait::io_wait()) and
+ * check again.
+ */
+#include <features.h>
+
+#include <l4/l4re_vfs/backend>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+#include <l4/sys/thread.h>
+
+#include <errno.h>
+#include <new>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+using namespace L4Re::Vfs;
+using cxx::Ref_ptr;
+
+#define ERRNO_RET(r) do { \
+  if ((r) < 0) \
+    {          \
+      errno = -(r); \
+      return -1; \
+    } } while (0)
+
+namespace {
+
+enum : l4_uint64_t { Forever = ~0ULL };
+
+/// Absolute deadline in microseconds of the KIP clock.
+l4_uint64_t
+deadline_after(l4_uint64_t us) noexcept
+{
+  l4_uint64_t now = l4_kip_clock(l4re_kip());
+  return us >= Forever - now ? Forever : now + us;
+}
+
+/**
+ * Wait for a readiness change since `gen`.
+ *
+ * \retval 0  Recheck the files.
+ * \retval 1  The deadline passed.
+ * \retval <0 Error.
+ */
+int
+wait_io(unsigned long gen, l4_uint64_t deadline) noexcept
+{
+  if (!deadline)
+    return 1;
+
+  int err = vfs_ops->io_wait(gen, deadline);
+  if (err == -ETIMEDOUT)
+    return 1;
+  return err;
+}
+
+/**
+ * Readiness of a file in terms of poll().
+ *
+ * \return The ready events out of `events` plus POLLERR and POLLHUP,
+ *         POLLNVAL if `fd` is not open.
+ */
+short
+file_events(int fd, short events) noexcept
+{
+  Ref_ptr<File> f = vfs_ops->get_file(fd);
+  if (!f)
+    return POLLNVAL;
+
+  short ask = events & (POLLIN | POLLPRI | POLLOUT);
+  if (events & POLLRDNORM)
+    ask |= POLLIN;
+  if (events & POLLWRNORM)
+    ask |= POLLOUT;
+
+  short r = f->poll_events(ask);
+  if ((r & POLLIN) && (events & POLLRDNORM))
+    r |= POLLRDNORM;
+  if ((r & POLLOUT) && (events & POLLWRNORM))
+    r |= POLLWRNORM;
+
+  return r & (events | POLLERR | POLLHUP);
+}
+
+int
+do_poll(struct pollfd *fds, nfds_t nfds, l4_uint64_t deadline) noexcept
+{
+  for (;;)
+    {
+      unsigned long gen = vfs_ops->io_generation();
+      int ready = 0;
+      for (nfds_t i = 0; i < nfds; ++i)
+        {
+          fds[i].revents = fds[i].fd < 0 ? 0
+                                         : file_events(fds[i].fd,
+                                                       fds[i].events);
+          if (fds[i].revents)
+            ++ready;
+        }
+
+      if (ready)
+        return ready;
+
+      int err = wait_io(gen, deadline);
+      if (err)
+        return err < 0 ? err : 0;
+    }
+}
+
+int
+do_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+          l4_uint64_t deadline) noexcept
+{
+  if (nfds < 0 || nfds > FD_SETSIZE)
+    return -EINVAL;
+
+  fd_set in_r, in_w, in_e;
+  FD_ZERO(&in_r);
+  FD_ZERO(&in_w);
+  FD_ZERO(&in_e);
+
+  if (readfds)
+    in_r = *readfds;
+  if (writefds)
+    in_w = *writefds;
+  if (exceptfds)
+    in_e = *exceptfds;
+
+  for (;;)
+    {
+      unsigned long gen = vfs_ops->io_generation();
+      fd_set out_r, out_w, out_e;
+      FD_ZERO(&out_r);
+      FD_ZERO(&out_w);
+      FD_ZERO(&out_e);
+
+      int ready = 0;
+      for (int fd = 0; fd < nfds; ++fd)
+        {
+          short events = 0;
+          if (FD_ISSET(fd, &in_r))
+            events |= POLLIN;
+          if (FD_ISSET(fd, &in_w))
+            events |= POLLOUT;
+          if (FD_ISSET(fd, &in_e))
+            events |= POLLPRI;
+
+          if (!events)
+            continue;
+
+          short r = file_events(fd, events);
+          if (r & POLLNVAL)
+            return -EBADF;
+
+          // like Linux, errors and hang-ups make a file readable and
+          // writable, so that the following call reports the condition
+          if ((events & POLLIN) && (r & (POLLIN | POLLERR | POLLHUP)))
+            {
+              FD_SET(fd, &out_r);
+              ++ready;
+            }
+          if ((events & POLLOUT) && (r & (POLLOUT | POLLERR)))
+            {
+              FD_SET(fd, &out_w);
+              ++ready;
+            }
+          if ((events & POLLPRI) && (r & POLLPRI))
+            {
+              FD_SET(fd, &out_e);
+              ++ready;
+            }
+        }
+
+      if (!ready)
+        {
+          int err = wait_io(gen, deadline);
+          if (err < 0)
+            return err;
+          if (!err)
+            continue;
+        }
+
+      if (readfds)
+        *readfds = out_r;
+      if (writefds)
+        *writefds = out_w;
+      if (exceptfds)
+        *exceptfds = out_e;
+
+      return ready;
+    }
+}
+
+/**
+ * Run `op` with the signal mask temporarily set to `mask`.
+ */
+template<typename OP>
+int
+with_sigmask(sigset_t const *mask, OP &&op) noexcept
+{
+  sigset_t old;
+  if (mask && sigprocmask(SIG_SETMASK, mask, &old) < 0)
+    return -errno;
+
+  int r = op();
+
+  if (mask)
+    sigprocmask(SIG_SETMASK, &old, 0);
+
+  return r;
+}
+
+/**
+ * File for an epoll instance.
+ *
+ * The interest list is a plain array that is scanned on every wait, like
+ * the file descriptors passed to poll(). EPOLLET is handled like level-
+ * triggered notification, which reports a superset of the edge-triggered
+ * events.
+ *
+ * The interest list is protected by a spin lock, so that epoll_ctl() can
+ * run while another thread waits in epoll_wait(). The lock is dropped while
+ * waiting for a readiness change.
+ */
+class Epoll_file : public Be_file
+{
+public:
+  ~Epoll_file() noexcept
+  {
+    for (unsigned i = 0; i < _num; ++i)
+      _entries[i].~Entry();
+    free(_entries);
+  }
+
+  int ctl(int op, int fd, struct epoll_event *event) noexcept;
+  int wait(struct epoll_event *events, int maxevents,
+           l4_uint64_t deadline) noexcept;
+
+  short poll_events(short events) noexcept override
+  {
+    if (!(events & POLLIN))
+      return 0;
+
+    Guard g(this);
+    for (unsigned i = 0; i < _num;)
+      {
+        Entry *e = &_entries[i];
+        Ref_ptr<File> f = file(e);
+        if (!f)
+          {
+            remove(e);
+            continue;
+          }
+
+        if (entry_events(e, f.get()))
+          return POLLIN;
+
+        ++i;
+      }
+
+    return 0;
+  }
+
+  int fstat64(struct stat64 *buf) const noexcept override
+  {
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = S_IRUSR | S_IWUSR;
+    return 0;
+  }
+
+private:
+  /**
+   * A registered file descriptor.
+   *
+   * The entry does not keep the file alive. A file that is closed while it
+   * is registered must be released, so that for example the peer of a pipe
+   * sees the end of file. The entry records the generation of the file
+   * descriptor and is dropped once the descriptor was closed or reused.
+   */
+  struct Entry
+  {
+    int fd;
+    unsigned long gen;
+    struct epoll_event ev;
+  };
+
+  struct Guard
+  {
+    explicit Guard(Epoll_file *ep) noexcept : _ep(ep) { _ep->lock(); }
+    ~Guard() noexcept { _ep->unlock(); }
+    Epoll_file *_ep;
+  };
+
+  void lock() noexcept
+  {
+    while (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE))
+      l4_thread_yield();
+  }
+
+  void unlock() noexcept
+  { __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE); }
+
+  Entry *_entries = 0;
+  unsigned _num = 0;
+  unsigned _size = 0;
+  int _lock = 0;
+
+  Entry *find(int fd) noexcept
+  {
+    for (unsigned i = 0; i < _num; ++i)
+      if (_entries[i].fd == fd)
+        return &_entries[i];
+    return 0;
+  }
+
+  bool grow() noexcept
+  {
+    unsigned nsize = _size ? _size * 2 : 8;
+    Entry *n = static_cast<Entry *>(malloc(nsize * sizeof(Entry)));
+    if (!n)
+      return false;
+
+    for (unsigned i = 0; i < _num; ++i)
+      {
+        new (&n[i]) Entry(_entries[i]);
+        _entries[i].~Entry();
+      }
+
+    free(_entries);
+    _entries = n;
+    _size = nsize;
+    return true;
+  }
+
+  void remove(Entry *e) noexcept
+  {
+    --_num;
+    if (e != &_entries[_num])
+      {
+        e->fd = _entries[_num].fd;
+        e->gen = _entries[_num].gen;
+        e->ev = _entries[_num].ev;
+      }
+    _entries[_num].~Entry();
+  }
+
+  /**
+   * Get a reference to the file of an entry.
+   *
+   * \return The file, or nil if it is no longer open under the file
+   *         descriptor of the entry. The reference keeps the file alive
+   *         while it is used.
+   */
+  static Ref_ptr<File> file(Entry const *e) noexcept
+  {
+    if (vfs_ops->fd_generation(e->fd) != e->gen)
+      return Ref_ptr<File>();
+    return vfs_ops->get_file(e->fd);
+  }
+
+  /// Ready events of an entry, 0 if there are none or it is disabled.
+  static uint32_t entry_events(Entry const *e, File *f) noexcept
+  {
+    uint32_t want = e->ev.events & (EPOLLIN | EPOLLPRI | EPOLLOUT);
+    if (!want)
+      return 0;
+
+    short r = f->poll_events(want);
+    return uint32_t(r) & (want | EPOLLERR | EPOLLHUP);
+  }
+};
+
+int
+Epoll_file::ctl(int op, int fd, struct epoll_event *event) noexcept
+{
+  Ref_ptr<File> f = vfs_ops->get_file(fd);
+  if (!f)
+    return -EBADF;
+
+  if (f.get() == this)
+    return -EINVAL;
+
+  unsigned long gen = vfs_ops->fd_generation(fd);
+
+  Guard g(this);
+  Entry *e = find(fd);
+
+  // the file descriptor was closed and reused since it was added
+  if (e && e->gen != gen)
+    {
+      remove(e);
+      e = 0;
+    }
+
+  switch (op)
+    {
+    case EPOLL_CTL_ADD:
+      if (e)
+        return -EEXIST;
+
+      if (!event)
+        return -EFAULT;
+
+      if (_num == _size && !grow())
+        return -ENOMEM;
+
+      new (&_entries[_num]) Entry{fd, gen, *event};
+      ++_num;
+      return 0;
+
+    case EPOLL_CTL_MOD:
+      if (!e)
+        return -ENOENT;
+
+      if (!event)
+        return -EFAULT;
+
+      e->ev = *event;
+      return 0;
+
+    case EPOLL_CTL_DEL:
+      if (!e)
+        return -ENOENT;
+
+      remove(e);
+      return 0;
+
+    default:
+      return -EINVAL;
+    }
+}
+
+int
+Epoll_file::wait(struct epoll_event *events, int maxevents,
+                 l4_uint64_t deadline) noexcept
+{
+  if (maxevents <= 0)
+    return -EINVAL;
+
+  for (;;)
+    {
+      unsigned long gen = vfs_ops->io_generation();
+      int ready = 0;
+
+      lock();
+      for (unsigned i = 0; i < _num && ready < maxevents;)
+        {
+          Entry *e = &_entries[i];
+
+          // drop files that were closed
+          Ref_ptr<File> f = file(e);
+          if (!f)
+            {
+              remove(e);
+              continue;
+            }
+
+          ++i;
+
+          uint32_t r = entry_events(e, f.get());
+          if (!r)
+            continue;
+
+          events[ready].events = r;
+          events[ready].data = e->ev.data;
+          ++ready;
+
+          if (e->ev.events & EPOLLONESHOT)
+            e->ev.events = 0;
+        }
+      unlock();
+
+      if (ready)
+        return ready;
+
+      int err = wait_io(gen, deadline);
+      if (err)
+        return err < 0 ? err : 0;
+    }
+}
+
+Ref_ptr<Epoll_file>
+get_epoll(int epfd, int *err) noexcept
+{
+  Ref_ptr<File> f = vfs_ops->get_file(epfd);
+  if (!f)
+    {
+      *err = -EBADF;
+      return Ref_ptr<Epoll_file>();
+    }
+
+  Epoll_file *ep = dynamic_cast<Epoll_file *>(f.get());
+  if (!ep)
+    *err = -EINVAL;
+
+  return Ref_ptr<Epoll_file>(ep);
+}
+
+}
+
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout) noexcept
+{
+  l4_uint64_t deadline = timeout < 0 ? Forever
+                         : timeout ? deadline_after(timeout * 1000ULL) : 0;
+
+  int r = do_poll(fds, nfds, deadline);
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+      const sigset_t *sigmask) noexcept
+{
+  l4_uint64_t deadline = Forever;
+  if (timeout)
+    {
+      if (timeout->tv_sec < 0 || timeout->tv_nsec < 0
+          || timeout->tv_nsec >= 1000000000)
+        ERRNO_RET(-EINVAL);
+
+      l4_uint64_t us = timeout->tv_sec * 1000000ULL
+                       + (timeout->tv_nsec + 999) / 1000;
+      deadline = us ? deadline_after(us) : 0;
+    }
+
+  int r = with_sigmask(sigmask,
+                       [=]{ return do_poll(fds, nfds, deadline); });
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+       struct timeval *timeout) noexcept
+{
+  l4_uint64_t deadline = Forever;
+  if (timeout)
+    {
+      if (timeout->tv_sec < 0 || timeout->tv_usec < 0)
+        ERRNO_RET(-EINVAL);
+
+      l4_uint64_t us = timeout->tv_sec * 1000000ULL + timeout->tv_usec;
+      deadline = us ? deadline_after(us) : 0;
+    }
+
+  int r = do_select(nfds, readfds, writefds, exceptfds, deadline);
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+        const struct timespec *timeout, const sigset_t *sigmask) noexcept
+{
+  l4_uint64_t deadline = Forever;
+  if (timeout)
+    {
+      if (timeout->tv_sec < 0 || timeout->tv_nsec < 0
+          || timeout->tv_nsec >= 1000000000)
+        ERRNO_RET(-EINVAL);
+
+      l4_uint64_t us = timeout->tv_sec * 1000000ULL
+                       + (timeout->tv_nsec + 999) / 1000;
+      deadline = us ? deadline_after(us) : 0;
+    }
+
+  int r = with_sigmask(sigmask, [=]
+    { return do_select(nfds, readfds, writefds, exceptfds, deadline); });
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+epoll_create1(int flags) noexcept
+{
+  if (flags & ~EPOLL_CLOEXEC)
+    ERRNO_RET(-EINVAL);
+
+  Ref_ptr<File> f(new Epoll_file());
+  if (!f)
+    ERRNO_RET(-ENOMEM);
+
+  int fd = vfs_ops->alloc_fd(f);
+  ERRNO_RET(fd);
+  return fd;
+}
+
+int
+epoll_create(int size) noexcept
+{
+  if (size <= 0)
+    ERRNO_RET(-EINVAL);
+
+  return epoll_create1(0);
+}
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) noexcept
+{
+  int err;
+  Ref_ptr<Epoll_file> ep = get_epoll(epfd, &err);
+  if (!ep)
+    ERRNO_RET(err);
+
+  int r = ep->ctl(op, fd, event);
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
+            int timeout, const sigset_t *sigmask) noexcept
+{
+  int err;
+  Ref_ptr<Epoll_file> ep = get_epoll(epfd, &err);
+  if (!ep)
+    ERRNO_RET(err);
+
+  l4_uint64_t deadline = timeout < 0 ? Forever
+                         : timeout ? deadline_after(timeout * 1000ULL) : 0;
+
+  int r = with_sigmask(sigmask, [&]
+    { return ep->wait(events, maxevents, deadline); });
+  ERRNO_RET(r);
+  return r;
+}
+
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+           int timeout) noexcept
+{
+  return epoll_pwait(epfd, events, maxevents, timeout, 0);
+}
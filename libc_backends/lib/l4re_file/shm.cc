@@ -0,0 +1,814 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+
+/*
+ * POSIX (shm_open) and System V (shmget) shared memory.
+ *
+ * A shared memory object is a dataspace registered in the name space that
+ * the application gets as the `shm` capability, for example from ned:
+ *
+ *     local shm = L4.default_loader:create_namespace({})
+ *     L4.default_loader:start({ caps = { shm = shm:m("rw") } }, "rom/app")
+ *
+ * Tasks that get the same name space share the objects. A POSIX object
+ * "/name" is registered as "name", a System V segment with key `k` as
+ * "sysv-<k in hex>". Segments with the key IPC_PRIVATE are not registered.
+ *
+ * shm_open() registers a new POSIX object right away, with the name space
+ * itself as a placeholder, so O_EXCL is exclusive and other tasks can open
+ * the object before its size is set. The dataspace is allocated with the
+ * first ftruncate() and replaces the placeholder. Tasks that set the size
+ * concurrently serialize on the registration of "<name>.init". Dataspaces
+ * cannot change their size, an object cannot be resized afterwards.
+ */
+#include <features.h>
+
+#include <l4/l4re_vfs/backend>
+#include <l4/cxx/minmax>
+#include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/namespace>
+#include <l4/re/rm>
+#include <l4/re/unique_cap>
+#include <l4/sys/thread.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace L4Re::Vfs;
+using cxx::Ref_ptr;
+
+#define ERRNO_RET(r) do { \
+  if ((r) < 0) \
+    {          \
+      errno = -(r); \
+      return -1; \
+    } } while (0)
+
+namespace {
+
+L4::Cap<L4Re::Namespace>
+shm_ns() noexcept
+{ return L4Re::Env::env()->get_cap<L4Re::Namespace>("shm"); }
+
+/// Map L4 errors of the name space to errno values.
+int
+ns_error(long err) noexcept
+{
+  switch (err)
+    {
+    case -L4_EEXIST: return -EEXIST;
+    case -L4_ENOENT: return -ENOENT;
+    case -L4_EPERM:
+    case -L4_EACCESS: return -EACCES;
+    case -L4_ENOMEM: return -ENOMEM;
+    default: return -EIO;
+    }
+}
+
+/**
+ * Look up a shared memory object in the name space.
+ *
+ * \retval 0        `ds` refers to the object.
+ * \retval -ENOENT  There is no object with that name.
+ */
+int
+lookup(L4::Cap<L4Re::Namespace> ns, char const *name,
+       L4Re::Unique_cap<L4Re::Dataspace> *ds) noexcept
+{
+  auto c = L4Re::make_unique_cap<L4Re::Dataspace>(L4Re::virt_cap_alloc);
+  if (!c.is_valid())
+    return -ENOMEM;
+
+  // do not wait for names that are only reserved
+  if (ns->query(name, c.get(), 0) < 0)
+    return -ENOENT;
+
+  *ds = cxx::move(c);
+  return 0;
+}
+
+/**
+ * Check whether `obj` is the placeholder of a POSIX object without memory.
+ */
+bool
+is_placeholder(L4::Cap<L4Re::Namespace> ns, L4::Cap<void> obj) noexcept
+{ return L4Re::Env::env()->task()->cap_equal(ns, obj).label() == 1; }
+
+/**
+ * Register the placeholder of a new POSIX object.
+ *
+ * \retval -EEXIST  There is an object with that name already.
+ */
+int
+register_placeholder(L4::Cap<L4Re::Namespace> ns, char const *name) noexcept
+{
+  long err = ns->register_obj(name, L4::Ipc::make_cap(ns, L4_CAP_FPAGE_RO),
+                              L4Re::Namespace::Ro);
+  return err < 0 ? ns_error(err) : 0;
+}
+
+/**
+ * Allocate the memory of a shared memory object.
+ *
+ * \param name     Name to register the object under, NULL for a private one.
+ * \param huge     Back the object with super pages.
+ * \param replace  Replace the placeholder registered under `name`.
+ *
+ * \retval -EEXIST  Another task registered an object with the same name
+ *                  in the meantime.
+ */
+int
+create(L4::Cap<L4Re::Namespace> ns, char const *name, unsigned long size,
+       bool huge, bool replace, L4Re::Unique_cap<L4Re::Dataspace> *ds) noexcept
+{
+  auto c = L4Re::make_unique_cap<L4Re::Dataspace>(L4Re::virt_cap_alloc);
+  if (!c.is_valid())
+    return -ENOMEM;
+
+  unsigned long alloc_flags = 0;
+  if (huge)
+    {
+      alloc_flags = L4Re::Mem_alloc::Continuous | L4Re::Mem_alloc::Super_pages;
+      size = l4_round_size(size, L4_SUPERPAGESHIFT);
+    }
+
+  long err = L4Re::Env::env()->mem_alloc()->alloc(size, c.get(), alloc_flags);
+  if (err < 0)
+    return err == -L4_ENOMEM ? -ENOMEM : -EIO;
+
+  if (name)
+    {
+      unsigned flags = L4Re::Namespace::Rw;
+      if (replace)
+        flags |= L4Re::Namespace::Overwrite;
+
+      err = ns->register_obj(name, L4::Ipc::make_cap_rw(c.get()), flags);
+      if (err < 0)
+        return ns_error(err);
+    }
+
+  *ds = cxx::move(c);
+  return 0;
+}
+
+/**
+ * An open POSIX shared memory object.
+ *
+ * Reads and writes go through a mapping of the dataspace, mmap() maps the
+ * dataspace directly.
+ */
+class Shm_file : public Be_file_pos
+{
+public:
+  Shm_file(L4::Cap<L4Re::Namespace> ns, char const *name, int flags,
+           mode_t mode, L4::Cap<L4Re::Dataspace> ds) noexcept
+  : _ns(ns), _ds(ds), _size(ds.is_valid() ? ds->size() : 0),
+    _flags(flags & (O_ACCMODE | O_NONBLOCK)), _mode(mode & 0777)
+  {
+    strncpy(_name, name, sizeof(_name) - 1);
+    _name[sizeof(_name) - 1] = 0;
+  }
+
+  ~Shm_file() noexcept
+  {
+    if (_addr)
+      L4Re::Env::env()->rm()->detach(l4_addr_t(_addr), 0);
+
+    if (_ds.is_valid())
+      L4Re::virt_cap_alloc->release(_ds);
+  }
+
+  L4::Cap<L4Re::Dataspace> data_space() noexcept override
+  {
+    refresh();
+    return _ds;
+  }
+
+  off64_t size() const noexcept override
+  {
+    refresh();
+    return _size;
+  }
+
+  int fstat64(struct stat64 *buf) const noexcept override
+  {
+    refresh();
+    memset(buf, 0, sizeof(*buf));
+    buf->st_size = _size;
+    buf->st_mode = S_IFREG | _mode;
+    buf->st_dev = _ns.cap();
+    buf->st_ino = _ds.cap();
+    buf->st_blksize = L4_PAGESIZE;
+    buf->st_blocks = l4_round_page(_size) / 512;
+    return 0;
+  }
+
+  int get_status_flags() const noexcept override
+  { return _flags; }
+
+  int set_status_flags(long flags) noexcept override
+  {
+    _flags = (_flags & O_ACCMODE) | (flags & O_NONBLOCK);
+    return 0;
+  }
+
+  int fsync() const noexcept override { return 0; }
+  int fdatasync() const noexcept override { return 0; }
+
+  int ftruncate64(off64_t len) noexcept override;
+  ssize_t preadv(const struct iovec *v, int cnt, off64_t offs) noexcept override;
+  ssize_t pwritev(const struct iovec *v, int cnt, off64_t offs) noexcept override;
+
+private:
+  void refresh() const noexcept;
+  int map() noexcept;
+
+  L4::Cap<L4Re::Namespace> _ns;
+  mutable L4::Cap<L4Re::Dataspace> _ds;
+  mutable off64_t _size;
+  char *_addr = 0;
+  int _flags;
+  mode_t _mode;
+  char _name[NAME_MAX + 1];
+};
+
+/**
+ * Pick up the dataspace of an object whose size another task has set.
+ */
+void
+Shm_file::refresh() const noexcept
+{
+  if (_ds.is_valid())
+    return;
+
+  L4Re::Unique_cap<L4Re::Dataspace> ds;
+  if (lookup(_ns, _name, &ds) < 0 || is_placeholder(_ns, ds.get()))
+    return;
+
+  _size = ds->size();
+  _ds = ds.release();
+}
+
+int
+Shm_file::ftruncate64(off64_t len) noexcept
+{
+  if (len < 0)
+    return -EINVAL;
+
+  if ((_flags & O_ACCMODE) == O_RDONLY)
+    return -EBADF;
+
+  if (_ds.is_valid())
+    return len == _size ? 0 : -EINVAL;
+
+  // Only the task that registers "<name>.init" allocates the dataspace,
+  // the other ones wait until it replaced the placeholder.
+  char init[NAME_MAX + sizeof(".init")];
+  snprintf(init, sizeof(init), "%s.init", _name);
+
+  bool initializing = false;
+  for (;;)
+    {
+      L4Re::Unique_cap<L4Re::Dataspace> ds;
+      int err = lookup(_ns, _name, &ds);
+      if (err < 0 && err != -ENOENT)
+        {
+          if (initializing)
+            _ns->unlink(init);
+          return err;
+        }
+
+      if (!err && !is_placeholder(_ns, ds.get()))
+        {
+          // another task set the size in the meantime
+          if (initializing)
+            _ns->unlink(init);
+
+          _size = ds->size();
+          _ds = ds.release();
+          return len == _size ? 0 : -EINVAL;
+        }
+
+      if (!len)
+        err = 0;
+      else if (err)
+        // an object unlinked before its size was set stays private
+        err = create(_ns, 0, len, false, false, &ds);
+      else if (!initializing)
+        {
+          err = register_placeholder(_ns, init);
+          if (err == -EEXIST)
+            {
+              usleep(1000);
+              continue;
+            }
+
+          if (err < 0)
+            return err;
+
+          // check again, the size may have been set before the registration
+          initializing = true;
+          continue;
+        }
+      else
+        err = create(_ns, _name, len, false, true, &ds);
+
+      if (initializing)
+        _ns->unlink(init);
+
+      if (err < 0 || !len)
+        return err;
+
+      _ds = ds.release();
+      _size = len;
+      return 0;
+    }
+}
+
+int
+Shm_file::map() noexcept
+{
+  if (_addr)
+    return 0;
+
+  refresh();
+  if (!_ds.is_valid())
+    return -EINVAL;
+
+  L4Re::Rm::Flags flags = (_flags & O_ACCMODE) == O_RDONLY
+                          ? L4Re::Rm::F::R : L4Re::Rm::F::RW;
+
+  l4_addr_t a = 0;
+  int err = L4Re::Env::env()->rm()->attach(&a, _size,
+                                           L4Re::Rm::F::Search_addr | flags,
+                                           L4::Ipc::make_cap(_ds,
+                                             flags.cap_rights()));
+  if (err < 0)
+    return err;
+
+  _addr = reinterpret_cast<char *>(a);
+  return 0;
+}
+
+ssize_t
+Shm_file::preadv(const struct iovec *v, int cnt, off64_t offs) noexcept
+{
+  if (cnt < 0)
+    return -EINVAL;
+
+  if (offs >= _size)
+    return 0;
+
+  int err = map();
+  if (err < 0)
+    return err;
+
+  ssize_t bytes = 0;
+  for (; cnt > 0 && offs < _size; --cnt, ++v)
+    {
+      size_t l = cxx::min<off64_t>(v->iov_len, _size - offs);
+      memcpy(v->iov_base, _addr + offs, l);
+      offs += l;
+      bytes += l;
+    }
+
+  return bytes;
+}
+
+ssize_t
+Shm_file::pwritev(const struct iovec *v, int cnt, off64_t offs) noexcept
+{
+  if (cnt < 0)
+    return -EINVAL;
+
+  if ((_flags & O_ACCMODE) == O_RDONLY)
+    return -EBADF;
+
+  // the object cannot grow
+  if (offs >= _size)
+    return -EFBIG;
+
+  int err = map();
+  if (err < 0)
+    return err;
+
+  ssize_t bytes = 0;
+  for (; cnt > 0 && offs < _size; --cnt, ++v)
+    {
+      size_t l = cxx::min<off64_t>(v->iov_len, _size - offs);
+      memcpy(_addr + offs, v->iov_base, l);
+      offs += l;
+      bytes += l;
+    }
+
+  return bytes;
+}
+
+/**
+ * Name of a POSIX object in the name space.
+ *
+ * The name must be "/name", without further slashes.
+ */
+char const *
+posix_name(char const *name, int *err) noexcept
+{
+  *err = -EINVAL;
+  if (!name || name[0] != '/' || !name[1] || strchr(name + 1, '/'))
+    return 0;
+
+  *err = -ENAMETOOLONG;
+  if (strlen(name + 1) > NAME_MAX)
+    return 0;
+
+  *err = 0;
+  return name + 1;
+}
+
+int
+do_shm_open(char const *path, int oflag, mode_t mode) noexcept
+{
+  int err;
+  char const *name = posix_name(path, &err);
+  if (!name)
+    return err;
+
+  L4::Cap<L4Re::Namespace> ns = shm_ns();
+  if (!ns.is_valid())
+    return -ENOSYS;
+
+  L4Re::Unique_cap<L4Re::Dataspace> ds;
+  err = lookup(ns, name, &ds);
+  if (err == -ENOENT && !(oflag & O_CREAT))
+    return err;
+  if (err < 0 && err != -ENOENT)
+    return err;
+  if (!err && (oflag & O_CREAT) && (oflag & O_EXCL))
+    return -EEXIST;
+
+  if (err)
+    {
+      err = register_placeholder(ns, name);
+      // another task created the object in the meantime
+      if (err == -EEXIST && !(oflag & O_EXCL))
+        err = lookup(ns, name, &ds);
+      if (err < 0)
+        return err;
+    }
+
+  // the object has no memory yet
+  if (ds.is_valid() && is_placeholder(ns, ds.get()))
+    ds.reset();
+
+  if (ds.is_valid() && (oflag & O_TRUNC))
+    {
+      // the size is fixed, truncating clears the contents
+      if ((oflag & O_ACCMODE) == O_RDONLY)
+        return -EACCES;
+      ds->clear(0, ds->size());
+    }
+
+  Ref_ptr<File> f(new Shm_file(ns, name, oflag, mode, ds.get()));
+  if (!f)
+    return -ENOMEM;
+
+  // the file owns the capability now
+  ds.release();
+
+  return vfs_ops->alloc_fd(f);
+}
+
+/**
+ * A System V segment known to this task.
+ *
+ * Segment IDs are indexes into a table local to the task. Attachments are
+ * counted per task, a removed segment releases its dataspace with the last
+ * detach.
+ */
+struct Sysv_seg
+{
+  L4::Cap<L4Re::Dataspace> ds;
+  key_t key;
+  unsigned long size;
+  unsigned long nattch;
+  unsigned short mode;
+  bool used;
+  bool removed;
+  bool huge;
+};
+
+struct Sysv_att
+{
+  l4_addr_t addr;
+  int id;
+};
+
+enum { Max_segs = 64, Max_atts = 128 };
+
+Sysv_seg segs[Max_segs];
+Sysv_att atts[Max_atts];
+int sysv_lock;
+
+struct Sysv_guard
+{
+  Sysv_guard() noexcept
+  {
+    while (__atomic_exchange_n(&sysv_lock, 1, __ATOMIC_ACQUIRE))
+      l4_thread_yield();
+  }
+
+  ~Sysv_guard() noexcept
+  { __atomic_store_n(&sysv_lock, 0, __ATOMIC_RELEASE); }
+};
+
+void
+sysv_name(key_t key, char *buf, size_t len) noexcept
+{ snprintf(buf, len, "sysv-%08x", static_cast<unsigned>(key)); }
+
+Sysv_seg *
+get_seg(int id) noexcept
+{
+  if (id < 0 || id >= Max_segs || !segs[id].used || segs[id].removed)
+    return 0;
+  return &segs[id];
+}
+
+void
+put_seg(Sysv_seg *s) noexcept
+{
+  if (!s->removed || s->nattch)
+    return;
+
+  L4Re::virt_cap_alloc->release(s->ds);
+  *s = Sysv_seg();
+}
+
+int
+add_seg(L4::Cap<L4Re::Dataspace> ds, key_t key, int flags, bool huge) noexcept
+{
+  for (int i = 0; i < Max_segs; ++i)
+    if (!segs[i].used)
+      {
+        segs[i].ds = ds;
+        segs[i].key = key;
+        segs[i].size = ds->size();
+        segs[i].nattch = 0;
+        segs[i].mode = flags & 0777;
+        segs[i].used = true;
+        segs[i].removed = false;
+        segs[i].huge = huge;
+        return i;
+      }
+
+  return -ENOSPC;
+}
+
+int
+do_shmget(key_t key, size_t size, int flags) noexcept
+{
+  bool huge = flags & SHM_HUGETLB;
+
+  if (key != IPC_PRIVATE)
+    for (int i = 0; i < Max_segs; ++i)
+      {
+        Sysv_seg *s = get_seg(i);
+        if (!s || s->key != key)
+          continue;
+
+        if ((flags & IPC_CREAT) && (flags & IPC_EXCL))
+          return -EEXIST;
+        if (size > s->size)
+          return -EINVAL;
+        return i;
+      }
+
+  L4::Cap<L4Re::Namespace> ns = shm_ns();
+  char name[16];
+  L4Re::Unique_cap<L4Re::Dataspace> ds;
+  int err = -ENOENT;
+
+  if (key != IPC_PRIVATE)
+    {
+      if (!ns.is_valid())
+        return -ENOSYS;
+
+      sysv_name(key, name, sizeof(name));
+      err = lookup(ns, name, &ds);
+      if (err < 0 && err != -ENOENT)
+        return err;
+      if (!err && (flags & IPC_CREAT) && (flags & IPC_EXCL))
+        return -EEXIST;
+      if (!err && size > ds->size())
+        return -EINVAL;
+      if (err && !(flags & IPC_CREAT))
+        return err;
+    }
+
+  if (err)
+    {
+      if (!size)
+        return -EINVAL;
+
+      err = create(ns, key == IPC_PRIVATE ? 0 : name, size, huge, false, &ds);
+      if (err < 0)
+        return err;
+    }
+
+  int id = add_seg(ds.get(), key, flags, huge);
+  if (id >= 0)
+    ds.release();
+
+  return id;
+}
+
+int
+do_shmat(int id, void const *addr, int flags, void **res) noexcept
+{
+  using L4Re::Rm;
+
+  Sysv_seg *s = get_seg(id);
+  if (!s)
+    return -EINVAL;
+
+  Sysv_att *att = 0;
+  for (auto &a: atts)
+    if (!a.addr)
+      {
+        att = &a;
+        break;
+      }
+
+  if (!att)
+    return -EMFILE;
+
+  l4_addr_t a = reinterpret_cast<l4_addr_t>(addr);
+  if (a && (flags & SHM_RND))
+    a = l4_trunc_page(a);
+  if (a & (L4_PAGESIZE - 1))
+    return -EINVAL;
+
+  Rm::Flags rm_flags = (flags & SHM_RDONLY) ? Rm::F::R : Rm::F::RW;
+  if (!a)
+    rm_flags |= Rm::F::Search_addr;
+
+  // super pages can only be mapped into suitably aligned regions
+  unsigned char align = s->huge ? L4_SUPERPAGESHIFT : L4_PAGESHIFT;
+
+  int err = L4Re::Env::env()->rm()->attach(&a, s->size, rm_flags,
+                                           L4::Ipc::make_cap(s->ds,
+                                             rm_flags.cap_rights()),
+                                           0, align);
+  if (err < 0)
+    return err == -L4_EADDRNOTAVAIL ? -EINVAL : -ENOMEM;
+
+  ++s->nattch;
+  att->addr = a;
+  att->id = id;
+  *res = reinterpret_cast<void *>(a);
+  return 0;
+}
+
+int
+do_shmdt(void const *addr) noexcept
+{
+  l4_addr_t a = reinterpret_cast<l4_addr_t>(addr);
+  for (auto &att: atts)
+    if (att.addr && att.addr == a)
+      {
+        L4Re::Env::env()->rm()->detach(a, 0);
+        att.addr = 0;
+
+        Sysv_seg *s = &segs[att.id];
+        --s->nattch;
+        put_seg(s);
+        return 0;
+      }
+
+  return -EINVAL;
+}
+
+int
+do_shmctl(int id, int cmd, struct shmid_ds *buf) noexcept
+{
+  Sysv_seg *s = get_seg(id);
+  if (!s)
+    return -EINVAL;
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+      memset(buf, 0, sizeof(*buf));
+      buf->shm_perm.__key = s->key;
+      buf->shm_perm.mode = s->mode | (s->huge ? SHM_HUGETLB : 0);
+      buf->shm_segsz = s->size;
+      buf->shm_nattch = s->nattch;
+      return 0;
+
+    case IPC_SET:
+      s->mode = (s->mode & ~0777) | (buf->shm_perm.mode & 0777);
+      return 0;
+
+    case IPC_RMID:
+      if (s->key != IPC_PRIVATE)
+        {
+          char name[16];
+          sysv_name(s->key, name, sizeof(name));
+          L4::Cap<L4Re::Namespace> ns = shm_ns();
+          if (ns.is_valid())
+            ns->unlink(name);
+        }
+
+      s->removed = true;
+      put_seg(s);
+      return 0;
+
+    case SHM_LOCK:
+    case SHM_UNLOCK:
+      // memory is never paged out
+      return 0;
+
+    default:
+      return -EINVAL;
+    }
+}
+
+}
+
+int
+shm_open(const char *name, int oflag, mode_t mode)
+{
+  int fd = do_shm_open(name, oflag, mode);
+  ERRNO_RET(fd);
+  return fd;
+}
+
+int
+shm_unlink(const char *path)
+{
+  int err;
+  char const *name = posix_name(path, &err);
+  ERRNO_RET(err);
+
+  L4::Cap<L4Re::Namespace> ns = shm_ns();
+  if (!ns.is_valid())
+    ERRNO_RET(-ENOSYS);
+
+  // mappings and open descriptors keep the memory alive
+  long r = ns->unlink(name);
+  if (r < 0)
+    ERRNO_RET(ns_error(r));
+  return 0;
+}
+
+int
+shmget(key_t key, size_t size, int shmflg) noexcept
+{
+  Sysv_guard g;
+  int id = do_shmget(key, size, shmflg);
+  ERRNO_RET(id);
+  return id;
+}
+
+void *
+shmat(int shmid, const void *shmaddr, int shmflg) noexcept
+{
+  Sysv_guard g;
+  void *res;
+  int err = do_shmat(shmid, shmaddr, shmflg, &res);
+  if (err < 0)
+    {
+      errno = -err;
+      return reinterpret_cast<void *>(-1);
+    }
+
+  return res;
+}
+
+int
+shmdt(const void *shmaddr) noexcept
+{
+  Sysv_guard g;
+  int err = do_shmdt(shmaddr);
+  ERRNO_RET(err);
+  return 0;
+}
+
+int
+shmctl(int shmid, int cmd, struct shmid_ds *buf) noexcept
+{
+  Sysv_guard g;
+  int err = do_shmctl(shmid, cmd, buf);
+  ERRNO_RET(err);
+  return err;
+}
@@ -9,28 +9,31 @@
 #include <errno.h>
 #include <sys/shm.h>
 
-int shmget(key_t key, size_t size, int shmflg)
+/* libc_be_l4refile provides the real implementation. */
+#define W __attribute__((weak))
+
+int W shmget(key_t key, size_t size, int shmflg)
 {
   printf("%s(%d, %zd, %d)\n", __func__, key, size, shmflg);
   errno = ENOSYS;
   return -1;
 }
 
-void *shmat(int shmid, const void *shmaddr, int shmflg)
+void W *shmat(int shmid, const void *shmaddr, int shmflg)
 {
   printf("%s(%d, %p, %d)\n", __func__, shmid, shmaddr, shmflg);
   errno = ENOSYS;
   return (void *)-1;
 }
 
-int shmctl(int shmid, int cmd, struct shmid_ds *buf)
+int W shmctl(int shmid, int cmd, struct shmid_ds *buf)
 {
   printf("%s(%d, %d, %p)\n", __func__, shmid, cmd, buf);
   errno = ENOSYS;
   return -1;
 }
 
-int shmdt(const void *shmaddr)
+int W shmdt(const void *shmaddr)
 {
   printf("%s(%p)\n", __func__, shmaddr);
   errno = ENOSYS;
@@ -9,7 +9,10 @@
 #include <errno.h>
 #include <time.h>
 
-int timer_delete(timer_t timer_id)
+/* The signal backend (libc_be_sig) provides the real implementation. */
+
+int __attribute__((weak))
+timer_delete(timer_t timer_id)
 {
   printf("Unimplemented: %s(timer_id)\n", __func__);
   (void)timer_id;
@@ -17,7 +20,8 @@ int timer_delete(timer_t timer_id)
   return -1;
 }
 
-int timer_gettime(timer_t timer_id, struct itimerspec *setting)
+int __attribute__((weak))
+timer_gettime(timer_t timer_id, struct itimerspec *setting)
 {
   printf("Unimplemented: %s(timer_id)\n", __func__);
   (void)timer_id;
@@ -26,7 +30,8 @@ int timer_gettime(timer_t timer_id, struct itimerspec *setting)
   return -1;
 }
 
-int timer_settime(timer_t timer_id, int __flags,
+int __attribute__((weak))
+timer_settime(timer_t timer_id, int __flags,
                   const struct itimerspec *__restrict __value,
                   struct itimerspec *__restrict __ovalue)
 {
@@ -39,7 +44,8 @@ int timer_settime(timer_t timer_id, int __flags,
   return -1;
 }
 
-int timer_create (clockid_t __clock_id,
+int __attribute__((weak))
+timer_create (clockid_t __clock_id,
                   struct sigevent *__restrict __evp,
                   timer_t *__restrict __timerid)
 {
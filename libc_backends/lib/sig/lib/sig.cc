@@ -21,7 +21,11 @@
 
 #include <errno.h>
 #include <signal.h>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -29,6 +33,7 @@
 
 #include <l4/sys/cxx/ipc_epiface>
 #include <l4/sys/cxx/ipc_server_loop>
+#include <l4/cxx/ipc_timeout_queue>
 
 namespace {
 struct Sig_handling : L4::Epiface_t<Sig_handling, L4::Exception>
@@ -40,11 +45,27 @@ struct Sig_handling : L4::Epiface_t<Sig_handling, L4::Exception>
   pthread_t pthread;
 
   struct itimerval current_itimerval;
+  /// Absolute expiry time of ITIMER_REAL, 0 if the timer is disarmed.
+  l4_kernel_clock_t itimer_timeout;
   l4_cpu_time_t alarm_timeout;
+  /// The handler thread waits for alarm_timeout or the interval timer.
+  bool alarm_wait;
+
+  /// Asynchronous signals waiting for delivery, one bit per signal.
+  unsigned long long pending_sigs;
+  /// Exceptions triggered by raise_async() that were not handled yet.
+  unsigned long async_triggers;
+
+  /// POSIX timers, run by the handler thread.
+  L4::Ipc_svr::Timeout_queue timers;
+  pthread_mutex_t timer_lock;
 
   Sig_handling();
 
   void ping_exc_handler() noexcept;
+  void raise_async(int sig) noexcept;
+  int take_pending_sig();
+  bool take_async_trigger();
   l4_addr_t get_handler(int signum);
   int get_any_async_handler();
   bool is_async_sig(int sig);
@@ -95,6 +116,47 @@ Sig_handling::is_async_sig(int sig)
     };
 }
 
+/**
+ * Take the lowest pending signal that has a handler.
+ *
+ * Pending signals without a handler are dropped.
+ */
+int
+Sig_handling::take_pending_sig()
+{
+  unsigned long long p = __atomic_load_n(&pending_sigs, __ATOMIC_ACQUIRE);
+  while (p)
+    {
+      int sig = __builtin_ctzll(p);
+      unsigned long long bit = 1ULL << sig;
+      __atomic_fetch_and(&pending_sigs, ~bit, __ATOMIC_ACQ_REL);
+      if (get_handler(sig))
+        return sig;
+      p &= ~bit;
+    }
+
+  return 0;
+}
+
+/**
+ * Account for an exception triggered by raise_async().
+ *
+ * \retval true   An outstanding raise_async() trigger was consumed.
+ * \retval false  The exception was triggered by someone else, e.g.
+ *                pthread_kill().
+ */
+bool
+Sig_handling::take_async_trigger()
+{
+  unsigned long n = __atomic_load_n(&async_triggers, __ATOMIC_ACQUIRE);
+  while (n)
+    if (__atomic_compare_exchange_n(&async_triggers, &n, n - 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return true;
+
+  return false;
+}
+
 int
 Sig_handling::get_any_async_handler()
 {
@@ -217,7 +279,16 @@ int Sig_handling::op_exception(L4::Exception::Rights, l4_exc_regs_t &exc,
     {
       //printf("SIGALRM\n");
 
-      int sig = get_any_async_handler();
+      bool own = take_async_trigger();
+      int sig = take_pending_sig();
+
+      // the signal of a raise_async() may have been delivered on a signal
+      // return already, anything else (pthread_kill) has no pending bit
+      if (!sig && own)
+        return -L4_EOK;
+
+      if (!sig)
+        sig = get_any_async_handler();
 
       if (sig == 0)
         {
@@ -261,6 +332,18 @@ int Sig_handling::op_exception(L4::Exception::Rights, l4_exc_regs_t &exc,
 
       fill_utcb_exc(u, ucf);
 
+      // deliver signals that were raised while the handler ran
+      if (int sig = take_pending_sig())
+        {
+          if (!setup_sig_frame(u, sig))
+            {
+              printf("Invalid user memory for sigframe...\n");
+              return -L4_ENOREPLY;
+            }
+
+          l4_utcb_exc_pc_set(u, get_handler(sig));
+        }
+
       //show_regs(u);
 
       exc = _u; // expensive? how to set amount of words in tag without copy?
@@ -301,24 +384,26 @@ struct Loop_hooks :
 {
   static l4_timeout_t timeout()
   {
-    if (_sig_handling.alarm_timeout)
-      {
-	l4_timeout_t t;
-	l4_rcv_timeout(l4_timeout_abs(_sig_handling.alarm_timeout, 1), &t);
-	_sig_handling.alarm_timeout = 0;
-	return t;
-      }
+    Sig_handling &s = _sig_handling;
 
-    struct timeval const tv = _sig_handling.current_itimerval.it_value;
-    if (tv.tv_sec == 0 && tv.tv_usec == 0)
-      return L4_IPC_NEVER;
+    l4_kernel_clock_t alarm = s.alarm_timeout;
+    if (!alarm || (s.itimer_timeout && s.itimer_timeout < alarm))
+      alarm = s.itimer_timeout;
+
+    pthread_mutex_lock(&s.timer_lock);
+    l4_kernel_clock_t next = s.timers.next_timeout();
+    pthread_mutex_unlock(&s.timer_lock);
 
-    l4_uint64_t us = 1000000ULL * tv.tv_sec + tv.tv_usec;
-    // Parameter range of l4_timeout_from_us(): ~0U = L4_IPC_TIMEOUT_NEVER!
-    if (us > L4_TIMEOUT_US_MAX)
-      us = L4_TIMEOUT_US_MAX;
+    s.alarm_wait = alarm && (!next || alarm <= next);
+    if (s.alarm_wait)
+      next = alarm;
 
-    return l4_timeout(L4_IPC_TIMEOUT_NEVER, l4_timeout_from_us(us));
+    if (!next)
+      return L4_IPC_NEVER;
+
+    l4_timeout_t t;
+    l4_rcv_timeout(l4_timeout_abs(next, 1), &t);
+    return t;
   }
 
   void error(l4_msgtag_t res, l4_utcb_t *utcb)
@@ -327,21 +412,34 @@ struct Loop_hooks :
 
     if (ipc_error == L4_IPC_RETIMEOUT)
       {
-	l4_msgtag_t t;
-
-        // any thread is ok, right?!
-	t = L4Re::Env::env()->main_thread()
-            ->ex_regs(~0UL, ~0UL,
-	              L4_THREAD_EX_REGS_TRIGGER_EXCEPTION);
-	if (l4_error(t))
-	  printf("ex_regs error\n");
-
-
-
-	// reload
-	_sig_handling.current_itimerval.it_value = _sig_handling.current_itimerval.it_interval;
-
-	return;
+        Sig_handling &s = _sig_handling;
+        l4_kernel_clock_t now = l4_kip_clock(l4re_kip());
+
+        pthread_mutex_lock(&s.timer_lock);
+        if (s.timers.timeout_expired(now))
+          s.timers.handle_expired_timeouts(now);
+        pthread_mutex_unlock(&s.timer_lock);
+
+        if (!s.alarm_wait)
+          return;
+
+        if (s.alarm_timeout && s.alarm_timeout <= now)
+          s.alarm_timeout = 0;
+
+        if (s.itimer_timeout && s.itimer_timeout <= now)
+          {
+            // reload
+            struct timeval const iv = s.current_itimerval.it_interval;
+            l4_kernel_clock_t us = 1000000ULL * iv.tv_sec + iv.tv_usec;
+            s.current_itimerval.it_value = iv;
+            if (!us)
+              s.itimer_timeout = 0;
+            else if ((s.itimer_timeout += us) <= now)
+              s.itimer_timeout = now + us;
+          }
+
+        s.raise_async(SIGALRM);
+        return;
       }
     printf("(unsupported/strange) loopabort: %lx\n", ipc_error);
   }
@@ -358,6 +456,8 @@ static void *__handler_main(void *)
 
 Sig_handling::Sig_handling()
 {
+  pthread_mutex_init(&timer_lock, 0);
+
   if (pthread_create(&pthread, 0, __handler_main, 0))
     {
       fprintf(stderr, "libsig: Failed to create handler thread\n");
@@ -396,6 +496,27 @@ void Sig_handling::ping_exc_handler() noexcept
   l4_ipc_call(thcap.cap(), l4_utcb(), l4_msgtag(0, 0, 0, 0), L4_IPC_NEVER);
 }
 
+/**
+ * Deliver an asynchronous signal to the main thread.
+ */
+void
+Sig_handling::raise_async(int sig) noexcept
+{
+  if (sig > 0 && sig < 64)
+    __atomic_or_fetch(&pending_sigs, 1ULL << sig, __ATOMIC_RELEASE);
+
+  __atomic_add_fetch(&async_triggers, 1, __ATOMIC_RELEASE);
+
+  // any thread is ok, right?!
+  l4_msgtag_t t = L4Re::Env::env()->main_thread()
+                    ->ex_regs(~0UL, ~0UL, L4_THREAD_EX_REGS_TRIGGER_EXCEPTION);
+  if (l4_error(t))
+    {
+      take_async_trigger();
+      printf("ex_regs error\n");
+    }
+}
+
 inline
 sighandler_t
 Sig_handling::signal(int signum, sighandler_t handler) noexcept
@@ -512,9 +633,19 @@ int getitimer(__itimer_which_t __which,
       return -1;
     }
 
-  *__value = _sig_handling.current_itimerval;
+  Sig_handling &s = _sig_handling;
+  *__value = s.current_itimerval;
+
+  // report the time left until the timer expires
+  l4_kernel_clock_t t = s.itimer_timeout;
+  if (t)
+    {
+      l4_kernel_clock_t now = l4_kip_clock(l4re_kip());
+      l4_kernel_clock_t left = t > now ? t - now : 1;
+      __value->it_value.tv_sec = left / 1000000;
+      __value->it_value.tv_usec = left % 1000000;
+    }
 
-  _sig_handling.ping_exc_handler();
   return 0;
 }
 
@@ -547,6 +678,13 @@ Sig_handling::setitimer(__itimer_which_t __which,
   printf("%s: setting stuff\n", __func__);
   current_itimerval = *__new;
 
+  // the handler thread only compares against the absolute expiry time
+  struct timeval const tv = __new->it_value;
+  itimer_timeout = (tv.tv_sec || tv.tv_usec)
+                   ? l4_kip_clock(l4re_kip())
+                     + 1000000ULL * tv.tv_sec + tv.tv_usec
+                   : 0;
+
   ping_exc_handler();
   return 0;
 }
@@ -563,3 +701,299 @@ int setitimer(__itimer_which_t __which,
     }
   return 0;
 }
+
+// -----------------------------------------------------------------------
+// POSIX timers
+
+namespace {
+
+/**
+ * A POSIX timer, run by the signal handler thread.
+ *
+ * Timers are kept in the timeout queue of the handler thread, which
+ * expires them at the kernel clock (microseconds).
+ */
+struct Posix_timer : L4::Ipc_svr::Timeout
+{
+  enum { Magic = 0x706f7469 };
+
+  unsigned magic = Magic;
+  clockid_t clock;
+  struct sigevent ev;
+  pthread_attr_t attr;
+  bool armed = false;
+  l4_kernel_clock_t interval = 0;
+  int overrun = 0;
+
+  void expired() override;
+  void notify();
+};
+
+struct Timer_notify
+{
+  void (*fn)(sigval_t);
+  sigval_t value;
+};
+
+static void *timer_thread(void *a)
+{
+  Timer_notify n = *static_cast<Timer_notify *>(a);
+  free(a);
+  n.fn(n.value);
+  return 0;
+}
+
+void
+Posix_timer::expired()
+{
+  overrun = 0;
+  if (interval)
+    {
+      // expirations the handler thread was too late for count as overruns
+      l4_kernel_clock_t now = l4_kip_clock(l4re_kip());
+      l4_kernel_clock_t missed = (now - timeout()) / interval;
+      overrun = missed > INT_MAX ? INT_MAX : missed;
+      _sig_handling.timers.add(this, timeout() + (missed + 1) * interval);
+    }
+  else
+    armed = false;
+
+  notify();
+}
+
+void
+Posix_timer::notify()
+{
+  switch (ev.sigev_notify)
+    {
+    case SIGEV_SIGNAL:
+      _sig_handling.raise_async(ev.sigev_signo);
+      break;
+
+    case SIGEV_THREAD:
+      {
+        Timer_notify *n = static_cast<Timer_notify *>(malloc(sizeof(*n)));
+        if (!n)
+          break;
+
+        n->fn = ev.sigev_notify_function;
+        n->value = ev.sigev_value;
+        pthread_t th;
+        if (pthread_create(&th, &attr, timer_thread, n))
+          free(n);
+        break;
+      }
+
+    default:
+      break;
+    }
+}
+
+Posix_timer *
+get_timer(timer_t id)
+{
+  Posix_timer *t = static_cast<Posix_timer *>(id);
+  if (!t || t->magic != Posix_timer::Magic)
+    return 0;
+
+  return t;
+}
+
+l4_uint64_t
+ts_ns(struct timespec const &ts)
+{ return ts.tv_sec * 1000000000ULL + ts.tv_nsec; }
+
+void
+ns_ts(l4_uint64_t ns, struct timespec *ts)
+{
+  ts->tv_sec = ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+}
+
+bool
+valid_ts(struct timespec const &ts)
+{ return ts.tv_sec >= 0 && ts.tv_nsec >= 0 && ts.tv_nsec < 1000000000; }
+
+void
+timer_get(Posix_timer const *t, struct itimerspec *v)
+{
+  l4_uint64_t ns = 0;
+  if (t->armed)
+    {
+      l4_kernel_clock_t now = l4_kip_clock(l4re_kip());
+      // an armed timer never reports a zero value
+      ns = t->timeout() > now ? (t->timeout() - now) * 1000 : 1;
+    }
+
+  ns_ts(ns, &v->it_value);
+  ns_ts(t->interval * 1000ULL, &v->it_interval);
+}
+
+}
+
+extern "C"
+int timer_create(clockid_t clock_id, struct sigevent *__restrict evp,
+                 timer_t *__restrict timer_id) L4_NOTHROW
+{
+  switch (clock_id)
+    {
+    case CLOCK_REALTIME:
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_BOOTTIME:
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+
+  struct sigevent ev;
+  if (evp)
+    ev = *evp;
+  else
+    {
+      ev.sigev_notify = SIGEV_SIGNAL;
+      ev.sigev_signo = SIGALRM;
+    }
+
+  switch (ev.sigev_notify)
+    {
+    case SIGEV_NONE:
+      break;
+    case SIGEV_SIGNAL:
+      if (ev.sigev_signo <= 0 || ev.sigev_signo >= 64)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      break;
+    case SIGEV_THREAD:
+      if (!ev.sigev_notify_function)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+
+  void *m = malloc(sizeof(Posix_timer));
+  if (!m)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+  Posix_timer *t = new (m) Posix_timer();
+  t->clock = clock_id;
+  t->ev = ev;
+  if (!evp)
+    t->ev.sigev_value.sival_ptr = t;
+
+  if (ev.sigev_notify == SIGEV_THREAD && ev.sigev_notify_attributes)
+    t->attr = *static_cast<pthread_attr_t *>(ev.sigev_notify_attributes);
+  else
+    pthread_attr_init(&t->attr);
+  pthread_attr_setdetachstate(&t->attr, PTHREAD_CREATE_DETACHED);
+
+  *timer_id = t;
+  return 0;
+}
+
+extern "C"
+int timer_delete(timer_t timer_id) L4_NOTHROW
+{
+  Posix_timer *t = get_timer(timer_id);
+  if (!t)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  pthread_mutex_lock(&_sig_handling.timer_lock);
+  if (t->armed)
+    _sig_handling.timers.remove(t);
+  t->magic = 0;
+  pthread_mutex_unlock(&_sig_handling.timer_lock);
+
+  t->~Posix_timer();
+  free(t);
+  return 0;
+}
+
+extern "C"
+int timer_settime(timer_t timer_id, int flags,
+                  const struct itimerspec *__restrict value,
+                  struct itimerspec *__restrict ovalue) L4_NOTHROW
+{
+  Posix_timer *t = get_timer(timer_id);
+  if (!t || !value
+      || !valid_ts(value->it_value) || !valid_ts(value->it_interval))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  l4_uint64_t delay = ts_ns(value->it_value);
+  if (delay && (flags & TIMER_ABSTIME))
+    {
+      struct timespec now;
+      if (clock_gettime(t->clock, &now) < 0)
+        return -1;
+
+      l4_uint64_t n = ts_ns(now);
+      // a time in the past expires immediately
+      delay = delay > n ? delay - n : 0;
+    }
+
+  pthread_mutex_lock(&_sig_handling.timer_lock);
+
+  if (ovalue)
+    timer_get(t, ovalue);
+
+  if (t->armed)
+    _sig_handling.timers.remove(t);
+
+  t->armed = ts_ns(value->it_value);
+  t->interval = (ts_ns(value->it_interval) + 999) / 1000;
+  t->overrun = 0;
+  if (t->armed)
+    _sig_handling.timers.add(t, l4_kip_clock(l4re_kip()) + (delay + 999) / 1000);
+
+  pthread_mutex_unlock(&_sig_handling.timer_lock);
+
+  // let the handler thread pick up the new timeout
+  _sig_handling.ping_exc_handler();
+  return 0;
+}
+
+extern "C"
+int timer_gettime(timer_t timer_id, struct itimerspec *value) L4_NOTHROW
+{
+  Posix_timer *t = get_timer(timer_id);
+  if (!t)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  pthread_mutex_lock(&_sig_handling.timer_lock);
+  timer_get(t, value);
+  pthread_mutex_unlock(&_sig_handling.timer_lock);
+  return 0;
+}
+
+extern "C"
+int timer_getoverrun(timer_t timer_id) L4_NOTHROW
+{
+  Posix_timer *t = get_timer(timer_id);
+  if (!t)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  return __atomic_load_n(&t->overrun, __ATOMIC_RELAXED);
+}
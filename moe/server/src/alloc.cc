@@ -39,6 +39,11 @@ Allocator::alloc(long size, unsigned long flags, unsigned long align)
   if (size == 0)
     throw L4::Bounds_error("stack too small");
 
+  unsigned node = Single_page_alloc_base::Any_node;
+  if (flags & L4Re::Mem_alloc::Numa_node)
+    node = (flags & L4Re::Mem_alloc::Numa_node_mask)
+           >> L4Re::Mem_alloc::Numa_node_shift;
+
   //L4::cout << "A: \n";
   Moe::Dataspace *mo;
   if (flags & L4Re::Mem_alloc::Continuous
@@ -49,14 +54,25 @@ Allocator::alloc(long size, unsigned long flags, unsigned long align)
       else
         align = cxx::max<unsigned long>(align, L4_PAGESHIFT);
 
-      mo = make_obj<Moe::Dataspace_anon>(size, L4Re::Dataspace::F::RWX, align);
+      mo = make_obj<Moe::Dataspace_anon>(size, L4Re::Dataspace::F::RWX, align,
+                                         node);
     }
   else
     {
       if (size < 0)
         throw L4::Bounds_error("invalid size");
 
-      mo = Moe::Dataspace_noncont::create(qalloc(), size);
+      // For on-demand allocated memory the alignment, or super pages,
+      // select the fault-around window.
+      unsigned char fault_around = 0;
+      if (flags & L4Re::Mem_alloc::Super_pages)
+        fault_around = L4_SUPERPAGESHIFT;
+      else if (align > L4_PAGESHIFT)
+        fault_around = cxx::min<unsigned long>(align, L4_SUPERPAGESHIFT);
+
+      mo = Moe::Dataspace_noncont::create(qalloc(), size,
+                                          L4Re::Dataspace::F::RWX,
+                                          fault_around, node);
       Obj_list::insert_after(mo, Obj_list::iter(this));
     }
 
@@ -274,6 +290,14 @@ Allocator::op_debug(L4Re::Debug_obj::Rights, unsigned long)
   out.printf("global: avail: %lu bytes (%lu MB)\n",
              Single_page_alloc_base::_avail(),
              Single_page_alloc_base::_avail() / (1<<20));
+  if (Single_page_alloc_base::_num_nodes() > 1)
+    for (unsigned n = 0; n < Single_page_alloc_base::_num_nodes(); ++n)
+      out.printf("node %u: total: %lu MB, avail: %lu MB\n", n,
+                 Single_page_alloc_base::_node_total(n) / (1<<20),
+                 Single_page_alloc_base::_node_avail(n) / (1<<20));
+  out.printf("global: super-page backed: %lu bytes (%lu MB)\n",
+             Moe::Dataspace_noncont::large_backed(),
+             Moe::Dataspace_noncont::large_backed() / (1<<20));
   out.printf("global physical free list:\n");
   Single_page_alloc_base::_dump_free(out);
   return L4_EOK;
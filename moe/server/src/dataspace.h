@@ -31,7 +31,8 @@ namespace Moe {
  * functions.
  */
 class Dataspace :
-  public L4::Epiface_t<Dataspace, L4Re::Dataspace, Server_object>,
+  public L4::Epiface_t<Dataspace, L4Re::Dataspace_map_info_t<L4Re::Dataspace>,
+                       Server_object>,
   public Q_object
 {
 public:
@@ -90,6 +91,15 @@ public:
 
   virtual int pre_allocate(l4_addr_t offset, l4_size_t size, unsigned rights) = 0;
 
+  /**
+   * Get the memory backing the whole dataspace, if it is contiguous.
+   *
+   * \retval 1  `start` and `end` (inclusive) are valid.
+   * \retval 0  The dataspace has no contiguous backing memory.
+   */
+  virtual long map_info(l4_addr_t * /*start*/, l4_addr_t * /*end*/) const noexcept
+  { return 0; }
+
   bool can_cow() const noexcept
   {
     return !!(_flags & Flags(Cow_enabled));
@@ -162,6 +172,10 @@ public:
     return L4_EOK;
   }
 
+  long op_map_info(L4Re::Dataspace_map_info::Rights, l4_addr_t &start_addr,
+                   l4_addr_t &end_addr)
+  { return map_info(&start_addr, &end_addr); }
+
   long op_clear(L4Re::Dataspace::Rights rights,
                 L4Re::Dataspace::Offset offset,
                 L4Re::Dataspace::Size size)
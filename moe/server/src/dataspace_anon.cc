@@ -20,7 +20,7 @@
 #include <climits>
 
 Moe::Dataspace_anon::Dataspace_anon(long size, Flags w,
-                                    unsigned char page_shift)
+                                    unsigned char page_shift, unsigned node)
 : Moe::Dataspace_cont(0, 0, w, page_shift)
 {
   Quota_guard g;
@@ -53,7 +53,8 @@ Moe::Dataspace_anon::Dataspace_anon(long size, Flags w,
 
       unsigned long r_size = size;
       void *_m = Single_page_alloc_base::_alloc_max(page_size(), &r_size,
-                                                    page_size(), page_size());
+                                                    page_size(), page_size(),
+                                                    node);
 
       if (!_m)
         L4Re::chksys(-L4_ENOMEM);
@@ -66,7 +67,7 @@ Moe::Dataspace_anon::Dataspace_anon(long size, Flags w,
     {
       unsigned long r_size = (size + page_size() - 1) & ~(page_size() -1);
       g = Quota_guard(qalloc()->quota(), r_size);
-      void *_m = Single_page_alloc_base::_alloc(r_size, page_size());
+      void *_m = Single_page_alloc_base::_alloc(r_size, page_size(), node);
 
       m = Single_page_unique_ptr(_m, r_size);
     }
@@ -21,7 +21,8 @@ class Dataspace_anon : public Dataspace_cont
 {
 public:
   Dataspace_anon(long size, Flags flags = L4Re::Dataspace::F::RWX,
-                 unsigned char page_shift = L4_PAGESHIFT);
+                 unsigned char page_shift = L4_PAGESHIFT,
+                 unsigned node = Single_page_alloc_base::Any_node);
   virtual ~Dataspace_anon();
 
   bool is_static() const noexcept override { return false; }
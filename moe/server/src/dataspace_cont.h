@@ -30,6 +30,16 @@ public:
   int copy_address(l4_addr_t offset, Flags flags,
                    l4_addr_t *addr, unsigned long *size) const override;
 
+  long map_info(l4_addr_t *start, l4_addr_t *end) const noexcept override
+  {
+    if (!_start || !size())
+      return 0;
+
+    *start = l4_addr_t(_start);
+    *end = l4_addr_t(_start) + round_size() - 1;
+    return 1;
+  }
+
   int dma_map(Dma_space *dma, l4_addr_t offset, l4_size_t *size,
               Dma_attribs dma_attrs, Dma_space::Direction dir,
               Dma_space::Dma_addr *dma_addr) override;
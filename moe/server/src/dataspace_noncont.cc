@@ -8,6 +8,7 @@
  * Please see the COPYING-GPL-2 file for details.
  */
 #include "dataspace_noncont.h"
+#include "globals.h"
 #include "quota.h"
 #include "pages.h"
 
@@ -22,6 +23,8 @@
 
 using cxx::min;
 
+unsigned long Moe::Dataspace_noncont::_large_backed;
+
 void
 Moe::Dataspace_noncont::unmap_page(Page const &p, bool ro) const noexcept
 {
@@ -35,17 +38,205 @@ void
 Moe::Dataspace_noncont::free_page(Page &p) const noexcept
 {
   unmap_page(p);
+  if (p.flags() & Page_large)
+    __atomic_sub_fetch(&_large_backed, page_size(), __ATOMIC_RELAXED);
+
   if (p.valid() && !Moe::Pages::unshare(*p))
     {
       //L4::cout << "free page @" << *p << '\n';
-      qalloc()->free_pages(*p, page_size());
+      if (page_size() == L4_PAGESIZE)
+        qalloc()->free_dirty_page(*p);
+      else
+        qalloc()->free_pages(*p, page_size());
     }
 
   p.set(0, 0);
 }
 
+void
+Moe::Dataspace_noncont::split_large(unsigned long offs) const noexcept
+{
+  l4_addr_t const w_offs = l4_trunc_size(offs, L4_SUPERPAGESHIFT);
+  l4_addr_t const w_end = min(w_offs + L4_SUPERPAGESIZE, round_size());
+
+  for (l4_addr_t o = w_offs; o < w_end; o += page_size())
+    {
+      Page &p = page(o);
+      if (p.flags() & Page_large)
+        {
+          p.set(*p, p.flags() & ~Page_large);
+          __atomic_sub_fetch(&_large_backed, page_size(), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void
+Moe::Dataspace_noncont::lazy_cow(unsigned long offs, Dataspace const *src,
+                                  unsigned long src_offs,
+                                  unsigned long size) const
+{
+  fill_lazy_cow();
+
+  // the range must read as the source, even where it was populated before
+  clear(offs, size);
+
+  _lazy.src = src;
+  _lazy.src_offs = src_offs;
+  _lazy.offs = offs;
+  _lazy.size = size;
+}
+
+/**
+ * Share the page at `offset` with the source of the lazy copy-on-write
+ * range, if it lies in the range and was not touched yet.
+ */
+void
+Moe::Dataspace_noncont::fill_lazy(Page &p, l4_addr_t offset) const
+{
+  if (p.valid() || offset - _lazy.offs >= _lazy.size)
+    return;
+
+  l4_addr_t o = l4_trunc_size(offset, page_shift()) - _lazy.offs;
+  Address a = _lazy.src->address(_lazy.src_offs + o, L4Re::Dataspace::F::R);
+  void *src_p = reinterpret_cast<void *>(
+                  l4_trunc_size(a.adr<l4_addr_t>(), page_shift()));
+  Moe::Pages::share(src_p);
+  p.set(src_p, Page_cow);
+}
+
+void
+Moe::Dataspace_noncont::fill_lazy_cow() const
+{
+  for (unsigned long o = 0; o < _lazy.size; o += page_size())
+    fill_lazy(alloc_page(_lazy.offs + o), _lazy.offs + o);
+
+  _lazy.size = 0;
+}
+
+/**
+ * Find the largest fault-around window for a fault at `offset`.
+ *
+ * The window is naturally aligned, lies within the dataspace, and the
+ * offset has the same alignment within the window as the hot spot in the
+ * receive window, so that the window can be sent as a single flexpage.
+ * The window also stays within `[min, max]` around the hot spot, memory
+ * beyond the region of the fault is not allocated.
+ */
+unsigned
+Moe::Dataspace_noncont::fault_around_order(l4_addr_t offset,
+                                           l4_addr_t hot_spot,
+                                           l4_addr_t min, l4_addr_t max) const
+{
+  if (hot_spot == ~0UL)
+    return page_shift();
+
+  // region faults pass the exact fault address
+  offset = l4_trunc_size(offset, page_shift());
+  hot_spot = l4_trunc_size(hot_spot, page_shift());
+
+  unsigned order = _fault_around;
+  for (; order > page_shift(); --order)
+    {
+      l4_addr_t mask = ~(~0UL << order);
+      if ((offset & ~mask) + mask > round_size() - 1)
+        continue;
+
+      if ((offset ^ hot_spot) & mask)
+        continue;
+
+      // same alignment, the window starts at `hot_spot & ~mask` in the
+      // receive window
+      if ((hot_spot & ~mask) < min || (hot_spot & ~mask) + mask > max)
+        continue;
+
+      break;
+    }
+
+  return order;
+}
+
+/**
+ * Populate the window of `1 << order` bytes around `offset` and return it
+ * as a single flexpage.
+ *
+ * A completely empty window is backed by one naturally aligned chunk of
+ * memory. The pages of the chunk are still managed (and reference counted)
+ * individually afterwards. A fully populated window is returned if its
+ * pages happen to be physically contiguous and do not need a COW break.
+ *
+ * \return The address of the window, or a nil address if the window cannot
+ *         be mapped as a whole.
+ */
+Moe::Dataspace::Address
+Moe::Dataspace_noncont::map_window(l4_addr_t offset, unsigned order,
+                                   Flags flags) const
+{
+  l4_addr_t const w_size = 1UL << order;
+  l4_addr_t const w_offs = l4_trunc_size(offset, order);
+  l4_addr_t const ps = page_size();
+
+  // Lazily shared pages are set up first, a read fault can then map them
+  // as a whole if the source is physically contiguous.
+  if (lazy_overlaps(w_offs, w_size))
+    for (l4_addr_t o = w_offs; o < w_offs + w_size; o += ps)
+      fill_lazy(alloc_page(o), o);
+
+  char *base = static_cast<char *>(*page(w_offs));
+  if (!base)
+    {
+      // make sure all page-table levels exist before taking the memory
+      for (l4_addr_t o = w_offs; o < w_offs + w_size; o += ps)
+        if (alloc_page(o).valid())
+          return Address(-L4_EEXIST);
+
+      base = static_cast<char *>(
+               qalloc()->alloc_pages(Single_page_alloc_base::nothrow,
+                                     w_size, w_size, _node));
+      if (!base)
+        return Address(-L4_ENOMEM);
+
+      unsigned long pg_flags = 0;
+      if (order >= L4_SUPERPAGESHIFT)
+        {
+          pg_flags = Page_large;
+          __atomic_add_fetch(&_large_backed, w_size, __ATOMIC_RELAXED);
+        }
+
+      for (l4_addr_t o = 0; o < w_size; o += ps)
+        {
+          page(w_offs + o).set(base + o, pg_flags);
+          Moe::Pages::share(base + o);
+        }
+
+      memset(base, 0, w_size);
+      // No need for I cache coherence, as we just zero fill and assume that
+      // this is no executable code
+      l4_cache_clean_data(reinterpret_cast<l4_addr_t>(base),
+                          reinterpret_cast<l4_addr_t>(base) + w_size);
+    }
+  else
+    {
+      if (reinterpret_cast<l4_addr_t>(base) & (w_size - 1))
+        return Address(-L4_EINVAL);
+
+      for (l4_addr_t o = 0; o < w_size; o += ps)
+        {
+          Page const &p = page(w_offs + o);
+          if (*p != base + o)
+            return Address(-L4_EINVAL);
+
+          if (flags.w() && (p.flags() & Page_cow))
+            return Address(-L4_EINVAL);
+        }
+    }
+
+  return Address(l4_addr_t(base), order, flags, offset & (w_size - 1));
+}
+
 Moe::Dataspace::Address
-Moe::Dataspace_noncont::map_address(l4_addr_t offset, Flags flags) const
+Moe::Dataspace_noncont::map_address(l4_addr_t offset, Flags flags,
+                                    l4_addr_t hot_spot, l4_addr_t min,
+                                    l4_addr_t max) const
 {
   // XXX: There may be a problem with data spaces with
   //      page_size() > L4_PAGE_SIZE
@@ -53,17 +244,29 @@ Moe::Dataspace_noncont::map_address(l4_addr_t offset, Flags flags) const
   if (!check_limit(offset))
     return Address(-L4_ERANGE);
 
-  Page &p = alloc_page(offset);
-
   flags &= map_flags();
 
+  // page faults on different dataspaces are handled in parallel
+  Lock_guard<Spin_lock> guard(_lock);
+
+  for (unsigned order = fault_around_order(offset, hot_spot, min, max);
+       order > page_shift(); --order)
+    {
+      Address a = map_window(offset, order, flags);
+      if (!a.is_nil())
+        return a;
+    }
+
+  Page &p = alloc_page(offset);
+  fill_lazy(p, offset);
+
   if (flags.w() && (p.flags() & Page_cow))
     {
       if (Moe::Pages::ref_count(*p) == 1)
         p.set(*p, p.flags() & ~Page_cow);
       else
         {
-          void *np = qalloc()->alloc_pages(page_size(), page_size());
+          void *np = qalloc()->alloc_pages(page_size(), page_size(), _node);
           Moe::Pages::share(np);
 
           // L4::cout << "copy on write for " << *p << " to " << np << '\n';
@@ -78,35 +281,33 @@ Moe::Dataspace_noncont::map_address(l4_addr_t offset, Flags flags) const
           l4_cache_clean_data(reinterpret_cast<l4_addr_t>(np),
                               reinterpret_cast<l4_addr_t>(np) + page_size());
           unmap_page(p);
-          Moe::Pages::unshare(*p);
+          // the other sharers may have broken COW concurrently
+          if (!Moe::Pages::unshare(*p))
+            qalloc()->free_dirty_page(*p);
           p.set(np, 0);
         }
     }
 
   if (!*p)
     {
-      p.set(qalloc()->alloc_pages(page_size(), page_size()), 0);
+      p.set(qalloc()->alloc_zeroed_page(_node), 0);
       Moe::Pages::share(*p);
-      memset(*p, 0, page_size());
-      // No need for I cache coherence, as we just zero fill and assume that
-      // this is no executable code
-      l4_cache_clean_data(reinterpret_cast<l4_addr_t>(*p),
-                          reinterpret_cast<l4_addr_t>(*p) + page_size());
     }
 
   return Address(l4_addr_t(*p), page_shift(), flags, offset & (page_size()-1));
 }
 
 Moe::Dataspace::Address
-Moe::Dataspace_noncont::address(l4_addr_t offset, Flags flags, l4_addr_t,
-                                l4_addr_t, l4_addr_t) const
-{ return map_address(offset, flags); }
+Moe::Dataspace_noncont::address(l4_addr_t offset, Flags flags,
+                                l4_addr_t hot_spot, l4_addr_t min,
+                                l4_addr_t max) const
+{ return map_address(offset, flags, hot_spot, min, max); }
 
 int
 Moe::Dataspace_noncont::copy_address(l4_addr_t offset, Flags flags,
                                      l4_addr_t *addr, unsigned long *size) const
 {
-  auto a = map_address(offset, flags);
+  auto a = map_address(offset, flags, offset);
   if (a.is_nil())
     return -L4_ERANGE;
 
@@ -123,12 +324,14 @@ Moe::Dataspace_noncont::pre_allocate(l4_addr_t offset, l4_size_t size, unsigned
 
   l4_addr_t end_off = l4_round_size(offset + size, page_shift());
 
-  l4_size_t ps = page_size();
-  for (l4_addr_t o = l4_trunc_size(offset, page_shift()); o < end_off; o += ps)
+  for (l4_addr_t o = l4_trunc_size(offset, page_shift()); o < end_off;)
     {
-      Address a = address(o, map_flags(rights));
+      Address a = map_address(o, map_flags(rights), o);
       if (a.is_nil())
         return a.error();
+
+      // skip the rest of a populated fault-around window
+      o += a.sz() - l4_trunc_size(a.of(), page_shift());
     }
   return 0;
 }
@@ -140,6 +343,20 @@ Moe::Dataspace_noncont::clear(unsigned long offs, unsigned long size) const noex
     return -L4_ERANGE;
 
   unsigned long sz = min(size, round_size()-offs);
+
+  // freed pages of the lazy range would be refilled from its source
+  if (lazy_overlaps(offs, sz))
+    {
+      try
+        {
+          fill_lazy_cow();
+        }
+      catch (L4::Runtime_error const &e)
+        {
+          return e.err_no();
+        }
+    }
+
   unsigned long pg_sz = page_size();
   unsigned long pre_sz = offs & (pg_sz-1);
   if (pre_sz)
@@ -152,6 +369,19 @@ Moe::Dataspace_noncont::clear(unsigned long offs, unsigned long size) const noex
 
   unsigned long u_sz = sz & ~(pg_sz-1);
 
+  // a partially cleared super-page chunk is split into single pages
+  if (u_sz)
+    {
+      l4_addr_t last = offs + u_sz - pg_sz;
+      if (l4_trunc_size(offs, L4_SUPERPAGESHIFT) != offs
+          && (page(offs).flags() & Page_large))
+        split_large(offs);
+
+      if (l4_trunc_size(last + pg_sz, L4_SUPERPAGESHIFT) != last + pg_sz
+          && (page(last).flags() & Page_large))
+        split_large(last);
+    }
+
   while (u_sz)
     {
       // printf("ds free page offs %lx\n", offs);
@@ -197,11 +427,17 @@ namespace {
   public:
     unsigned long meta_size() const noexcept
     { return (l4_round_size(num_pages()*sizeof(unsigned long), Meta_align_bits)); }
-    Mem_small(unsigned long size, Flags flags)
-    : Moe::Dataspace_noncont(size, flags)
+    Mem_small(unsigned long size, Flags flags, unsigned char fault_around)
+    : Moe::Dataspace_noncont(size, flags, fault_around)
     {
-      void *p = qalloc()->alloc_pages(meta_size(), Meta_align);
-      memset(p, 0, meta_size());
+      void *p;
+      if (meta_size() == L4_PAGESIZE)
+        p = qalloc()->alloc_zeroed_page();
+      else
+        {
+          p = qalloc()->alloc_pages(meta_size(), Meta_align);
+          memset(p, 0, meta_size());
+        }
       _pages = static_cast<Page *>(p);
     }
 
@@ -265,8 +501,8 @@ namespace {
     long meta1_size() const noexcept
     { return l4_round_size(entries1() * sizeof(L1 *), 10); }
 
-    Mem_big(unsigned long size, Flags flags)
-    : Moe::Dataspace_noncont(size, flags)
+    Mem_big(unsigned long size, Flags flags, unsigned char fault_around)
+    : Moe::Dataspace_noncont(size, flags, fault_around)
     {
       void *p = qalloc()->alloc_pages(meta1_size(), 1024);
       memset(p, 0, meta1_size());
@@ -303,10 +539,9 @@ namespace {
       L1 &_p = __p(offs);
       if (!*_p)
         {
-          void *a = qalloc()->alloc_pages(meta2_size(), meta2_size());
+          void *a = qalloc()->alloc_zeroed_page();
           assert (((l4_addr_t)a & 0xfff) == 0);
           _p.set(a);
-          memset(a, 0, meta2_size());
         }
 
       return _p[l2_idx(offs)];
@@ -317,13 +552,28 @@ namespace {
 
 Moe::Dataspace_noncont *
 Moe::Dataspace_noncont::create(Moe::Q_alloc *q, unsigned long size,
-                               Flags flags)
+                               Flags flags, unsigned char fault_around,
+                               unsigned node)
 {
+  if (!fault_around)
+    {
+      fault_around = Moe::fault_around;
+      if (Moe::transparent_superpages && size >= L4_SUPERPAGESIZE)
+        fault_around = L4_SUPERPAGESHIFT;
+    }
+
+  fault_around = cxx::max<unsigned char>(fault_around, L4_PAGESHIFT);
+  fault_around = cxx::min<unsigned char>(fault_around, L4_SUPERPAGESHIFT);
+
+  Dataspace_noncont *ds;
   if (size <= L4_PAGESIZE)
-    return q->make_obj<Mem_one_page>(size, flags);
+    ds = q->make_obj<Mem_one_page>(size, flags);
   else if (size <= L4_PAGESIZE * (L4_PAGESIZE / sizeof(unsigned long)))
-    return q->make_obj<Mem_small>(size, flags);
+    ds = q->make_obj<Mem_small>(size, flags, fault_around);
   else
-    return q->make_obj<Mem_big>(size, flags);
+    ds = q->make_obj<Mem_big>(size, flags, fault_around);
+
+  ds->_node = node;
+  return ds;
 }
 
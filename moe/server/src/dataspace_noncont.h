@@ -10,6 +10,7 @@
 #pragma once
 
 #include "dataspace.h"
+#include "lock.h"
 
 namespace Moe {
 
@@ -26,6 +27,8 @@ public:
   {
     Page_addr_mask = ~((1UL << 12)-1),
     Page_cow = 0x04UL,
+    /// Page is part of a super-page sized chunk of physical memory.
+    Page_large = 0x08UL,
   };
 
   class Page
@@ -62,8 +65,10 @@ public:
   bool is_static() const noexcept override { return false; }
 
   Dataspace_noncont(unsigned long size,
-                    Flags flags = L4Re::Dataspace::F::RWX) noexcept
-  : Dataspace(size, flags | Flags(Cow_enabled), L4_LOG2_PAGESIZE), _pages(0)
+                    Flags flags = L4Re::Dataspace::F::RWX,
+                    unsigned char fault_around = 0) noexcept
+  : Dataspace(size, flags | Flags(Cow_enabled), L4_LOG2_PAGESIZE), _pages(0),
+    _fault_around(fault_around)
   {}
 
   virtual ~Dataspace_noncont() {}
@@ -99,11 +104,50 @@ private:
   void free_page(Page &p) const noexcept;
   void unmap_page(Page const &p, bool ro = false) const noexcept;
 
+  /**
+   * Split the super-page chunk containing `offs` into individual pages.
+   *
+   * The memory stays in place, it is just no longer accounted as
+   * super-page backed.
+   */
+  void split_large(unsigned long offs) const noexcept;
+
+  /**
+   * Back the page-aligned range at `offs` by the pages of the static
+   * dataspace `src` at `src_offs`.
+   *
+   * Nothing is set up right away, each page is shared copy-on-write with
+   * `src` when it is touched for the first time. Untouched pages cost
+   * neither memory nor page-table entries. A dataspace has a single such
+   * range, the remaining pages of a previous range are shared first.
+   */
+  void lazy_cow(unsigned long offs, Dataspace const *src,
+                unsigned long src_offs, unsigned long size) const;
+
+  /// Share all untouched pages of the lazy copy-on-write range.
+  void fill_lazy_cow() const;
+
+  /// Number of bytes in all dataspaces that are backed by super pages.
+  static unsigned long large_backed() noexcept { return _large_backed; }
+
 public:
   long clear(unsigned long offs, unsigned long size) const noexcept override;
 
+  /**
+   * Create a dataspace of the matching flavour for `size`.
+   *
+   * \param q             Quota allocator for the dataspace.
+   * \param size          Size of the dataspace in bytes.
+   * \param flags         Dataspace flags.
+   * \param fault_around  Log2 size of the window populated on a page fault.
+   *                      0 selects the global default (Moe::fault_around).
+   * \param node          Preferred NUMA node for the memory of the dataspace.
+   */
   static Dataspace_noncont *create(Q_alloc *q, unsigned long size,
-                                   Flags flags = L4Re::Dataspace::F::RWX);
+                                   Flags flags = L4Re::Dataspace::F::RWX,
+                                   unsigned char fault_around = 0,
+                                   unsigned node
+                                     = Single_page_alloc_base::Any_node);
 
 protected:
   union
@@ -113,6 +157,40 @@ protected:
   };
 
 private:
-  Address map_address(l4_addr_t offset, Flags flags) const;
+  unsigned fault_around_order(l4_addr_t offset, l4_addr_t hot_spot,
+                              l4_addr_t min, l4_addr_t max) const;
+  Address map_window(l4_addr_t offset, unsigned order, Flags flags) const;
+  Address map_address(l4_addr_t offset, Flags flags,
+                      l4_addr_t hot_spot = ~0UL, l4_addr_t min = 0,
+                      l4_addr_t max = ~0UL) const;
+  void fill_lazy(Page &p, l4_addr_t offset) const;
+
+  bool lazy_overlaps(l4_addr_t offs, unsigned long size) const noexcept
+  {
+    return _lazy.size && offs < _lazy.offs + _lazy.size
+           && _lazy.offs < offs + size;
+  }
+
+  /// Range that is shared lazily with a static dataspace, see lazy_cow().
+  struct Lazy_cow
+  {
+    Dataspace const *src = 0;
+    unsigned long src_offs = 0;
+    unsigned long offs = 0;
+    unsigned long size = 0;
+  };
+
+  mutable Lazy_cow _lazy;
+
+  /// Log2 size of the window populated on a page fault.
+  unsigned char _fault_around;
+
+  /// Preferred NUMA node for the memory pages.
+  unsigned _node = Single_page_alloc_base::Any_node;
+
+  /// Serializes page faults handled by different server threads.
+  mutable Spin_lock _lock;
+
+  static unsigned long _large_backed;
 };
 };
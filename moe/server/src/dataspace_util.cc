@@ -58,23 +58,14 @@ __do_real_copy(Dataspace *dst, unsigned long &dst_offs,
 }
 
 inline void
-__do_cow_copy(Dataspace_noncont *dst, unsigned long &dst_offs, unsigned dst_pg_sz,
+__do_cow_copy(Dataspace_noncont *dst, unsigned long &dst_offs,
     Dataspace const *src, unsigned long &src_offs, unsigned long sz)
 {
-  while (sz)
-    {
-      Dataspace::Address src_a = src->address(src_offs, L4Re::Dataspace::F::R);
-      Dataspace_noncont::Page &dst_p = dst->alloc_page(dst_offs);
-      dst->free_page(dst_p);
-      void *src_p = reinterpret_cast<void*>(
-                      trunc_page(dst_pg_sz, src_a.adr<unsigned long>()));
-      Moe::Pages::share(src_p);
-      dst_p.set(src_p, Dataspace_noncont::Page_cow);
+  // the pages are shared when they are touched in the destination
+  dst->lazy_cow(dst_offs, src, src_offs, sz);
 
-      src_offs += dst_pg_sz;
-      dst_offs += dst_pg_sz;
-      sz  -= dst_pg_sz;
-    }
+  src_offs += sz;
+  dst_offs += sz;
 }
 
 inline void
@@ -94,6 +85,10 @@ __do_cow_copy2(Dataspace_noncont *dst, unsigned long &dst_offs, unsigned dst_pg_
       dst->free_page(*dst_p);
       if (*src_p)
         {
+          // shared pages are never accounted as super-page backed
+          if (src_p.flags() & Dataspace_noncont::Page_large)
+            src->split_large(src_offs);
+
           Moe::Pages::share(*src_p);
           if (!(src_p.flags() & Dataspace_noncont::Page_cow))
             {
@@ -179,7 +174,7 @@ __do_lazy_copy(Dataspace_noncont *dst, unsigned long dst_offs,
   if (0)
     L4::cout << "cow_sz=" << cow_sz << "; cp_sz=" << cp_sz << '\n';
 
-  __do_cow_copy(dst, dst_offs, dst_pg_sz, src, src_offs, cow_sz);
+  __do_cow_copy(dst, dst_offs, src, src_offs, cow_sz);
   __do_real_copy(dst, dst_offs, src, src_offs, cp_sz);
 
   return true;
@@ -263,9 +258,14 @@ Dataspace_util::copy(Dataspace *dst, unsigned long dst_offs,
         {
           Dataspace_noncont *dst_n = dynamic_cast<Dataspace_noncont*>(dst);
           Dataspace_noncont const *src_n = dynamic_cast<Dataspace_noncont const *>(src);
-          if (dst_n && src_n
-              && __do_lazy_copy2(dst_n, dst_offs, src_n, src_offs, size))
-            return size;
+          if (dst_n && src_n)
+            {
+              // the page arrays must show the lazily shared pages
+              dst_n->fill_lazy_cow();
+              src_n->fill_lazy_cow();
+              if (__do_lazy_copy2(dst_n, dst_offs, src_n, src_offs, size))
+                return size;
+            }
         }
     }
 
@@ -335,7 +335,7 @@ Dma_space::op_associate(L4Re::Dma_space::Rights,
     }
   else
     {
-      L4::Cap<L4::Task> rcv_cap(Rcv_cap << L4_CAP_SHIFT);
+      L4::Cap<L4::Task> rcv_cap = L4::cap_cast<L4::Task>(::rcv_cap());
       if (!dma_task.cap_received())
         return -L4_EINVAL;
 
@@ -15,6 +15,12 @@ L4::Cap<void> root_name_space_obj;
 static Cap_alloc _cap_allocator __attribute__((init_priority(1400)));
 Object_pool __attribute__((init_priority(1401))) object_pool(&_cap_allocator);
 
+Moe::Rw_lock Moe::Server_threads::request_lock;
+l4_addr_t Moe::Server_threads::_utcb_base;
+unsigned Moe::Server_threads::_count;
+unsigned Moe::Server_threads::_next_gate;
+L4::Cap<L4::Thread> Moe::Server_threads::_threads[Max_threads];
+
 char log_buffer[1024];
 Moe::Dataspace *kip_ds;
 extern char const *const PROG = "moe";
@@ -32,6 +32,10 @@ namespace Moe { namespace Virt_limit {
 namespace Moe {
   extern unsigned l4re_dbg;
   extern unsigned ldr_flags;
+  /// Default log2 size of the fault-around window of anonymous memory.
+  extern unsigned char fault_around;
+  /// Back large on-demand allocated dataspaces with super pages.
+  extern bool transparent_superpages;
 }
 
 enum
@@ -52,6 +52,11 @@ struct Moe_app_model : public Ldr::Base_app_model<Moe::Stack>
                       unsigned long size);
 
   static bool all_segs_cow() { return false; }
+  static bool prefetch_segs() { return false; }
+
+  static void prefetch_ds(Dataspace ds, unsigned long offs,
+                          unsigned long size)
+  { ds->pre_allocate(offs, size, L4_CAP_FPAGE_RW); }
 
   l4_addr_t local_attach_ds(Const_dataspace ds, unsigned long size,
                             unsigned long offset) const;
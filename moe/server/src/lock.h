@@ -0,0 +1,127 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/sys/thread.h>
+
+namespace Moe {
+
+/**
+ * Spin lock for data that is shared between Moe's server threads.
+ *
+ * A waiting thread yields the CPU instead of busy waiting. With a single
+ * server thread the lock is never contended.
+ */
+class Spin_lock
+{
+public:
+  Spin_lock() = default;
+  Spin_lock(Spin_lock const &) = delete;
+  Spin_lock &operator = (Spin_lock const &) = delete;
+
+  void lock() noexcept
+  {
+    while (__atomic_exchange_n(&_locked, 1, __ATOMIC_ACQUIRE))
+      l4_thread_yield();
+  }
+
+  void unlock() noexcept
+  { __atomic_store_n(&_locked, 0, __ATOMIC_RELEASE); }
+
+private:
+  int _locked = 0;
+};
+
+/**
+ * Reader-writer lock serializing the server threads.
+ *
+ * Requests that only touch data protected by finer-grained locks are
+ * handled in parallel under the shared lock, all other requests take
+ * the lock exclusively. A waiting writer holds off new readers.
+ */
+class Rw_lock
+{
+public:
+  Rw_lock() = default;
+  Rw_lock(Rw_lock const &) = delete;
+  Rw_lock &operator = (Rw_lock const &) = delete;
+
+  void lock() noexcept
+  {
+    __atomic_add_fetch(&_writers, 1, __ATOMIC_RELAXED);
+    int free = 0;
+    while (!__atomic_compare_exchange_n(&_state, &free, -1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      {
+        free = 0;
+        l4_thread_yield();
+      }
+    __atomic_sub_fetch(&_writers, 1, __ATOMIC_RELAXED);
+  }
+
+  void unlock() noexcept
+  { __atomic_store_n(&_state, 0, __ATOMIC_RELEASE); }
+
+  void lock_shared() noexcept
+  {
+    for (;;)
+      {
+        int s = __atomic_load_n(&_state, __ATOMIC_RELAXED);
+        if (s >= 0 && !__atomic_load_n(&_writers, __ATOMIC_RELAXED)
+            && __atomic_compare_exchange_n(&_state, &s, s + 1, false,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED))
+          return;
+
+        l4_thread_yield();
+      }
+  }
+
+  void unlock_shared() noexcept
+  { __atomic_sub_fetch(&_state, 1, __ATOMIC_RELEASE); }
+
+private:
+  /// -1: locked exclusively, otherwise the number of shared holders
+  int _state = 0;
+  /// Number of threads waiting for the exclusive lock
+  int _writers = 0;
+};
+
+/**
+ * Hold a lock for the lifetime of the guard.
+ */
+template<typename LOCK>
+class Lock_guard
+{
+public:
+  explicit Lock_guard(LOCK &l) noexcept : _l(l) { _l.lock(); }
+  ~Lock_guard() noexcept { _l.unlock(); }
+
+  Lock_guard(Lock_guard const &) = delete;
+  Lock_guard &operator = (Lock_guard const &) = delete;
+
+private:
+  LOCK &_l;
+};
+
+/**
+ * Hold a lock in shared mode for the lifetime of the guard.
+ */
+template<typename LOCK>
+class Shared_lock_guard
+{
+public:
+  explicit Shared_lock_guard(LOCK &l) noexcept : _l(l) { _l.lock_shared(); }
+  ~Shared_lock_guard() noexcept { _l.unlock_shared(); }
+
+  Shared_lock_guard(Shared_lock_guard const &) = delete;
+  Shared_lock_guard &operator = (Shared_lock_guard const &) = delete;
+
+private:
+  LOCK &_l;
+};
+
+}
@@ -9,11 +9,16 @@
  */
 #include <l4/re/log>
 #include <l4/re/log-sys.h>
+#include <l4/re/error_helper>
 #include <l4/sys/kdebug.h>
+#include <l4/sys/irq>
 #include <l4/cxx/minmax>
+#include <l4/cxx/unique_ptr>
 
+#include "dataspace_anon.h"
 #include "globals.h"
 #include "log.h"
+#include "server_threads.h"
 
 #include <unistd.h>
 #include <cstdio>
@@ -90,21 +95,156 @@ void Pbuf::outnstring(char const *str, unsigned long len)
   checknflush(len);
 }
 
+/**
+ * Shared-memory ring of a log client.
+ *
+ * The client writes its output into the ring and triggers the IRQ of the
+ * ring as doorbell. Moe prints the output of the ring in batches. The ring
+ * memory belongs to Moe, so output that reached the ring is printed even if
+ * the client dies without ringing the doorbell.
+ */
+class Moe::Log_ring : public L4::Irqep_t<Log_ring, Moe::Server_object>
+{
+public:
+  enum
+  {
+    Default_size = 16 << 10,
+    Min_size     = 1 << 10,
+    Max_size     = 256 << 10,
+  };
+
+  Log_ring(Moe::Log *log, unsigned long size);
+  ~Log_ring();
+
+  L4::Cap<L4Re::Dataspace> ds_cap() const
+  { return L4::cap_cast<L4Re::Dataspace>(_ds->obj_cap()); }
+
+  /// Print everything that is in the ring.
+  void drain();
+
+  void handle_irq() { drain(); }
+
+private:
+  Moe::Log *_log;
+  cxx::unique_ptr<Moe::Dataspace> _ds;
+  L4Re::Log_::Ring *_r;
+  l4_uint32_t _size;
+  l4_uint32_t _dropped;
+};
+
+Moe::Log_ring::Log_ring(Moe::Log *log, unsigned long size)
+: _log(log), _dropped(0)
+{
+  _size = Min_size;
+  while (_size < size && _size < Max_size)
+    _size <<= 1;
+
+  _ds.reset(log->qalloc()->make_obj<Moe::Dataspace_anon>(
+              sizeof(L4Re::Log_::Ring) + _size, L4Re::Dataspace::F::RW));
+
+  // Moe keeps its reference to the dataspace, it lives as long as the ring.
+  object_pool.cap_alloc()->alloc(_ds.get());
+  _r = _ds->address(0, L4Re::Dataspace::F::RW).adr<L4Re::Log_::Ring *>();
+  _r->size = _size;
+  _r->armed = 1;
+
+  auto irq = L4Re::chkcap(object_pool.cap_alloc()->alloc<L4::Irq>());
+  set_server(&object_pool, irq, true);
+  L4Re::chksys(L4Re::Env::env()->factory()->create(irq));
+  L4Re::chksys(irq->bind_thread(Moe::Server_threads::gate_thread(),
+                                l4_umword_t(static_cast<L4::Epiface *>(this))));
+}
+
+Moe::Log_ring::~Log_ring()
+{
+  // flush what a crashed or exited client left in the ring
+  drain();
+}
+
+void
+Moe::Log_ring::drain()
+{
+  l4_uint32_t head = __atomic_load_n(&_r->head, __ATOMIC_ACQUIRE);
+  l4_uint32_t tail = _r->tail;
+
+  // do not trust the client, skip over a broken ring
+  if (head - tail > _size)
+    tail = head;
+
+  while (tail != head)
+    {
+      l4_uint32_t offs = tail & (_size - 1);
+      l4_uint32_t n = cxx::min(head - tail, _size - offs);
+      _log->print(_r->data() + offs, n);
+      tail += n;
+    }
+
+  __atomic_store_n(&_r->tail, tail, __ATOMIC_RELEASE);
+
+  l4_uint32_t dropped = __atomic_load_n(&_r->dropped, __ATOMIC_RELAXED);
+  if (dropped != _dropped)
+    {
+      char b[48];
+      int l = snprintf(b, sizeof(b), "[%u bytes of log output dropped]\n",
+                       dropped - _dropped);
+      _dropped = dropped;
+      _log->print(b, cxx::min<unsigned long>(l, sizeof(b) - 1));
+    }
+
+  __atomic_store_n(&_r->armed, 1, __ATOMIC_SEQ_CST);
+  // The client may have written after the head was read without seeing
+  // the doorbell armed. Queue another round instead of looping, so that a
+  // busy client cannot keep Moe from serving others.
+  if (__atomic_load_n(&_r->head, __ATOMIC_SEQ_CST) != tail)
+    L4::cap_cast<L4::Irq>(obj_cap())->trigger();
+}
+
+Moe::Log::~Log()
+{
+  delete _ring;
+}
+
+l4_msgtag_t
+Moe::Log::setup_ring(l4_utcb_t *utcb, l4_msgtag_t tag)
+{
+  l4_msg_regs_t *m = l4_utcb_mr_u(utcb);
+
+  // the ring has a single producer
+  if (_ring)
+    return l4_msgtag(-L4_EBUSY, 0, 0, 0);
+
+  unsigned long size = tag.words() > 1 ? m->mr[1] : 0;
+  if (!size)
+    size = Log_ring::Default_size;
+
+  cxx::unique_ptr<Log_ring> r(qalloc()->make_obj<Log_ring>(this, size));
+  _ring = r.release();
+
+  m->mr[0] = L4_ITEM_MAP | L4_ITEM_CONT;
+  m->mr[1] = l4_obj_fpage(_ring->ds_cap().cap(), 0, L4_CAP_FPAGE_RW).raw;
+  m->mr[2] = L4_ITEM_MAP;
+  m->mr[3] = l4_obj_fpage(_ring->obj_cap().cap(), 0, L4_CAP_FPAGE_RO).raw;
+  return l4_msgtag(0, 0, 2, 0);
+}
+
 l4_msgtag_t
 Moe::Log::op_dispatch(l4_utcb_t *utcb, l4_msgtag_t tag, L4::Vcon::Rights)
 {
-  enum { Max_tag = 8 };
-  if (tag.words() < 2)
+  if (tag.words() < 1)
     return l4_msgtag(-L4_EINVAL, 0, 0, 0);
 
   l4_msg_regs_t *m = l4_utcb_mr_u(utcb);
   L4::Opcode op = m->mr[0];
 
-  // we only have one opcode
+  if (op == L4Re::Log_::Setup_ring)
+    return setup_ring(utcb, tag);
+
   if (op != L4Re::Log_::Print)
     return l4_msgtag(-L4_ENOSYS, 0, 0, 0);
 
-  char *msg = log_buffer;
+  if (tag.words() < 2)
+    return l4_msgtag(-L4_EINVAL, 0, 0, 0);
+
   unsigned long len_msg = sizeof(log_buffer);
 
   if (len_msg > (tag.words() - 2) * sizeof(l4_umword_t))
@@ -113,8 +253,22 @@ Moe::Log::op_dispatch(l4_utcb_t *utcb, l4_msgtag_t tag, L4::Vcon::Rights)
   if (len_msg > m->mr[1])
     len_msg = m->mr[1];
 
-  memcpy(msg, &m->mr[2], len_msg);
+  memcpy(log_buffer, &m->mr[2], len_msg);
+
+  // keep the order with earlier output that is still in the ring
+  if (_ring)
+    _ring->drain();
+
+  print(log_buffer, len_msg);
+
+  // and finally done
+  return l4_msgtag(-L4_ENOREPLY, 0, 0, 0);
+}
 
+void
+Moe::Log::print(char const *msg, unsigned long len_msg)
+{
+  enum { Max_tag = 8 };
   static Pbuf ob;
 
   while (len_msg > 0 && msg[0])
@@ -168,9 +322,6 @@ Moe::Log::op_dispatch(l4_utcb_t *utcb, l4_msgtag_t tag, L4::Vcon::Rights)
 
   if (_in_line && color())
     ob.printf("\033[0m");
-
-  // and finally done
-  return l4_msgtag(-L4_ENOREPLY, 0, 0, 0);
 }
 
 
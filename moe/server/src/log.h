@@ -14,20 +14,28 @@
 #include <l4/sys/cxx/ipc_epiface>
 #include <l4/cxx/string>
 
+#include "quota.h"
 #include "server_obj.h"
 
 namespace Moe {
 
-class Log : public L4::Epiface_t<Log, L4::Vcon, Moe::Server_object>
+class Log_ring;
+
+class Log :
+  public L4::Epiface_t<Log, L4::Vcon, Moe::Server_object>,
+  public Q_object
 {
 private:
   char const *_tag;
   unsigned long _l;
   unsigned char _color;
   bool _in_line;
+  Log_ring *_ring;
+
+  l4_msgtag_t setup_ring(l4_utcb_t *utcb, l4_msgtag_t tag);
 
 public:
-  Log() : _tag(0), _l(0), _color(0), _in_line(false) {}
+  Log() : _tag(0), _l(0), _color(0), _in_line(false), _ring(0) {}
   void set_tag(char const *tag, int len)
   { _tag = tag; _l = len; }
   void set_color(unsigned char color)
@@ -36,7 +44,10 @@ public:
   char const *tag() const { return _tag; }
   unsigned char color() const { return _color; }
 
-  virtual ~Log() {}
+  virtual ~Log();
+
+  /// Print `len` bytes of log output with the tag of this log.
+  void print(char const *msg, unsigned long len);
 
   static int color_value(cxx::String const &col);
 
@@ -25,6 +25,7 @@
 #include <l4/cxx/l4iostream>
 
 #include <l4/util/l4mod.h>
+#include <l4/util/thread.h>
 #include <typeinfo>
 
 #include <cctype>
@@ -43,6 +44,7 @@
 #include "dataspace_static.h"
 #include "debug.h"
 #include "args.h"
+#include "server_threads.h"
 
 #include <l4/re/env>
 
@@ -61,6 +63,11 @@ void _exit(int status)
 
 unsigned Moe::l4re_dbg = Dbg::Warn;
 unsigned Moe::ldr_flags;
+unsigned char Moe::fault_around = L4_PAGESHIFT;
+bool Moe::transparent_superpages;
+
+/// Number of server threads, 0 for one per online CPU.
+static unsigned _num_threads = 1;
 
 
 static Dbg info(Dbg::Info);
@@ -116,7 +123,67 @@ char *my_cmdline()
   return cmdline;
 }
 
+/// Parse a hexadecimal number with optional `0x` prefix.
+static int parse_hex(cxx::String const &s, unsigned long *v)
+{
+  int p = 0;
+  if (s.starts_with("0x") || s.starts_with("0X"))
+    p = 2;
 
+  int n = s.substr(p).from_hex(v);
+  return n > 0 ? p + n : -1;
+}
+
+/**
+ * Assign physical memory to a NUMA node.
+ *
+ * The argument is `<node>:<start>-<end>` with hexadecimal addresses, the
+ * option may be given for multiple ranges and nodes.
+ */
+static void hdl_numa_node(cxx::String const &args)
+{
+  unsigned long node, start, end;
+  int n = args.from_dec(&node);
+  if (n > 0 && !args.eof(args.start() + n) && args[n] == ':')
+    {
+      cxx::String r = args.substr(n + 1);
+      n = parse_hex(r, &start);
+      if (n > 0 && !r.eof(r.start() + n) && r[n] == '-')
+        {
+          cxx::String e = r.substr(n + 1);
+          if (parse_hex(e, &end) == e.len()
+              && Single_page_alloc_base::_add_node_range(node, start, end))
+            return;
+        }
+    }
+
+  warn.printf("invalid argument for --numa-node: '%.*s'\n",
+              args.len(), args.start());
+}
+
+/**
+ * Handle the options that are needed before Moe takes the memory from
+ * sigma0. They are skipped by the regular option parsing in main().
+ */
+static void parse_early_options()
+{
+  bool skip_argv0 = true;
+  cxx::Pair<cxx::String, cxx::String> a;
+  for (a = next_arg(my_cmdline()); !a.first.empty(); a = next_arg(a.second))
+    {
+      if (skip_argv0)
+        {
+          skip_argv0 = false;
+          continue;
+        }
+
+      if (a.first[0] != '-' || a.first == "--")
+        break;
+
+      if (a.first.starts_with("--numa-node="))
+        hdl_numa_node(a.first.substr(strlen("--numa-node=")));
+    }
+}
 
 static void find_memory()
 {
@@ -152,6 +219,10 @@ static void find_memory()
 
   info.printf("found %ld KByte free memory\n",
               Single_page_alloc_base::_avail() / 1024);
+  if (Single_page_alloc_base::_num_nodes() > 1)
+    for (unsigned n = 0; n < Single_page_alloc_base::_num_nodes(); ++n)
+      info.printf("  node %u: %ld KByte\n", n,
+                  Single_page_alloc_base::_node_total(n) / 1024);
 
   // adjust min_addr and max_addr to also contain boot modules
   for (auto const &md: L4::Kip::Mem_desc::all(kip()))
@@ -261,14 +332,32 @@ new_sigma0_cap()
 }
 
 class Loop_hooks :
-  public L4::Ipc_svr::Ignore_errors,
-  public L4::Ipc_svr::Default_timeout,
   public L4::Ipc_svr::Compound_reply
 {
 public:
+  /**
+   * Do not block in the receive phase while there are pages to be
+   * scrubbed, so that this can be done while there is no request.
+   * Scrubbing is done by the initial server thread only.
+   */
+  static l4_timeout_t timeout()
+  {
+    if (Moe::Server_threads::self() == 0
+        && Single_page_alloc_base::_scrub_pending())
+      return L4_IPC_BOTH_TIMEOUT_0;
+
+    return L4_IPC_SEND_TIMEOUT_0;
+  }
+
+  static void error(l4_msgtag_t tag, l4_utcb_t *utcb)
+  {
+    if (l4_ipc_error(tag, utcb) == L4_IPC_RETIMEOUT)
+      Single_page_alloc_base::_scrub();
+  }
+
   static void setup_wait(l4_utcb_t *utcb, L4::Ipc_svr::Reply_mode)
   {
-    l4_utcb_br_u(utcb)->br[0] = L4::Ipc::Small_buf(Rcv_cap << L4_CAP_SHIFT,
+    l4_utcb_br_u(utcb)->br[0] = L4::Ipc::Small_buf(rcv_cap().cap(),
                                                    L4_RCV_ITEM_LOCAL_ID).raw();
     l4_utcb_br_u(utcb)->br[1] = 0;
     l4_utcb_br_u(utcb)->bdr = 0;
@@ -281,8 +370,42 @@ class My_dispatcher
 private:
   Reg r;
 
+  /**
+   * Check whether a request can run in parallel to other requests.
+   *
+   * This holds for page faults to dataspaces, which only touch the
+   * dataspace, the page allocator and the quota, that are all protected
+   * by their own locks.
+   */
+  static bool is_shared(l4_msgtag_t tag, l4_utcb_t *utcb)
+  {
+    typedef L4Re::Dataspace::Rpcs::Rpc<L4Re::Dataspace::map_t> Map;
+    return tag.label() == L4Re::Dataspace::Protocol
+           && tag.words() > 0
+           && L4::Opcode(l4_utcb_mr_u(utcb)->mr[0]) == Map::Opcode;
+  }
+
 public:
   l4_msgtag_t dispatch(l4_msgtag_t tag, l4_umword_t obj, l4_utcb_t *utcb)
+  {
+    Moe::Rw_lock &l = Moe::Server_threads::request_lock;
+    l4_msgtag_t res;
+    if (!is_shared(tag, utcb))
+      {
+        Moe::Lock_guard<Moe::Rw_lock> guard(l);
+        res = do_dispatch(tag, obj, utcb);
+      }
+    else
+      {
+        Moe::Shared_lock_guard<Moe::Rw_lock> guard(l);
+        res = do_dispatch(tag, obj, utcb);
+      }
+
+    Moe::Server_object::quiescent();
+    return res;
+  }
+
+  l4_msgtag_t do_dispatch(l4_msgtag_t tag, l4_umword_t obj, l4_utcb_t *utcb)
   {
     typename Reg::Value *o = 0;
 
@@ -319,6 +442,13 @@ public:
             return l4_msgtag(-L4_ENOENT, 0, 0, 0);
           }
 
+        // received before the object was deleted by another server thread
+        if (Moe::Server_object::is_deleted(o))
+          {
+            dbg.cprintf(": deleted object\n");
+            return l4_msgtag(-L4_ENOENT, 0, 0, 0);
+          }
+
         dbg.cprintf(": object is a %s\n", typeid(*o).name());
         try
           {
@@ -371,6 +501,7 @@ static Dbg_bits const ldr_flag_bits[] =
    {"eager_map",    L4RE_AUX_LDR_FLAG_EAGER_MAP},
    {"all_segs_cow", L4RE_AUX_LDR_FLAG_ALL_SEGS_COW},
    {"pinned_segs",  L4RE_AUX_LDR_FLAG_PINNED_SEGS},
+   {"prefetch",     L4RE_AUX_LDR_FLAG_PREFETCH},
    {"exit",  0x10},
    {0, 0}};
 
@@ -433,11 +564,88 @@ static void hdl_ldr_flags(cxx::String const &args)
 
 
 
+static void hdl_fault_around(cxx::String const &args)
+{
+  unsigned long size;
+  int n = args.from_dec(&size);
+  if (n <= 0)
+    {
+      warn.printf("invalid argument for --fault-around: '%.*s'\n",
+                  args.len(), args.start());
+      return;
+    }
+
+  cxx::String unit = args.substr(n);
+  if (unit == "K" || unit == "k")
+    size <<= 10;
+  else if (unit == "M" || unit == "m")
+    size <<= 20;
+  else if (!unit.empty())
+    warn.printf("ignore unknown unit for --fault-around: '%.*s'\n",
+                unit.len(), unit.start());
+
+  unsigned char order = L4_PAGESHIFT;
+  while (order < L4_SUPERPAGESHIFT && (2UL << order) <= size)
+    ++order;
+
+  Moe::fault_around = order;
+}
+
+static void hdl_zero_pool(cxx::String const &args)
+{
+  unsigned long low, high;
+  int n = args.from_dec(&low);
+  if (n <= 0 || args.eof(args.start() + n) || args[n] != ',')
+    {
+      warn.printf("invalid argument for --zero-pool: '%.*s'\n",
+                  args.len(), args.start());
+      return;
+    }
+
+  cxx::String h = args.substr(n + 1);
+  if (h.from_dec(&high) != h.len())
+    {
+      warn.printf("invalid argument for --zero-pool: '%.*s'\n",
+                  args.len(), args.start());
+      return;
+    }
+
+  Single_page_alloc_base::_zero_pool_watermarks(low, high);
+}
+
+static void hdl_superpages(cxx::String const &)
+{
+  Moe::transparent_superpages = true;
+}
+
+static void hdl_early(cxx::String const &)
+{
+  // handled by parse_early_options()
+}
+
+static void hdl_threads(cxx::String const &args)
+{
+  unsigned long n;
+  if (args.from_dec(&n) != args.len())
+    {
+      warn.printf("invalid argument for --threads: '%.*s'\n",
+                  args.len(), args.start());
+      return;
+    }
+
+  _num_threads = n;
+}
+
 static Get_opt const _options[] = {
-      {"--debug=",     hdl_debug },
-      {"--init=",      hdl_init },
-      {"--l4re-dbg=",  hdl_l4re_dbg },
-      {"--ldr-flags=", hdl_ldr_flags },
+      {"--debug=",        hdl_debug },
+      {"--init=",         hdl_init },
+      {"--l4re-dbg=",     hdl_l4re_dbg },
+      {"--ldr-flags=",    hdl_ldr_flags },
+      {"--fault-around=", hdl_fault_around },
+      {"--superpages",    hdl_superpages },
+      {"--zero-pool=",    hdl_zero_pool },
+      {"--threads=",      hdl_threads },
+      {"--numa-node=",    hdl_early },
       {0, 0}
 };
 
@@ -487,6 +695,94 @@ static Elf_loader elf_loader;
 
 static L4::Server<Loop_hooks> server;
 
+L4UTIL_THREAD_STATIC_FUNC(server_thread)
+{
+  // we handle our exceptions ourselves
+  server.loop_noexc(My_dispatcher<L4::Basic_registry>());
+}
+
+/**
+ * Start the additional server threads requested with `--threads`.
+ *
+ * Each thread runs on its own CPU, starting with the CPU after the one of
+ * the initial thread. IPC gates created afterwards are distributed across
+ * all server threads.
+ */
+static void
+start_server_threads()
+{
+  enum { Stack_size = 4 * L4_PAGESIZE };
+
+  L4::Cap<L4::Scheduler> sched(L4_BASE_SCHEDULER_CAP);
+  l4_umword_t cpu_max;
+  l4_sched_cpu_set_t cpus = l4_sched_cpu_set(0, 0);
+  if (l4_error(sched->info(&cpu_max, &cpus)) < 0)
+    cpus.map = 1;
+
+  unsigned n = _num_threads;
+  if (!n)
+    n = __builtin_popcountl(cpus.map);
+
+  if (n > Moe::Server_threads::Max_threads)
+    {
+      warn.printf("limiting number of server threads to %u\n",
+                  unsigned(Moe::Server_threads::Max_threads));
+      n = Moe::Server_threads::Max_threads;
+    }
+
+  unsigned cpu = 0;
+  for (unsigned i = 1; i < n; ++i)
+    {
+      l4_utcb_t *utcb = Moe::Server_threads::utcb(i);
+      if (!utcb)
+        {
+          warn.printf("no UTCB for server thread %u\n", i);
+          break;
+        }
+
+      // next online CPU, round robin
+      do
+        cpu = (cpu + 1) % (sizeof(cpus.map) * 8);
+      while (cpus.map && !(cpus.map & (1UL << cpu)));
+
+      auto t = object_pool.cap_alloc()->alloc<L4::Thread>();
+      char *stack = static_cast<char *>(
+                      Single_page_alloc_base::_alloc(Stack_size, L4_PAGESIZE));
+
+      l4_sched_param_t sp = l4_sched_param(0xff);
+      sp.affinity = l4_sched_cpu_set(cpu, 0);
+
+      long err = l4util_create_thread(t.cap(), utcb, L4_BASE_FACTORY_CAP,
+                                      l4_umword_t(server_thread),
+                                      l4_umword_t(stack + Stack_size),
+                                      L4_BASE_PAGER_CAP, L4_BASE_TASK_CAP,
+                                      sched.cap(), sp);
+      if (err < 0)
+        {
+          warn.printf("could not start server thread %u: %ld\n", i, err);
+          Single_page_alloc_base::_free(stack, Stack_size);
+          object_pool.cap_alloc()->free(t);
+          break;
+        }
+
+      l4_debugger_set_object_name(t.cap(), "moe");
+      Moe::Server_threads::add(t);
+    }
+
+  if (Moe::Server_threads::count() > 1)
+    {
+      Moe::Server_object::init_deferred_free();
+      info.printf("running %u server threads\n", Moe::Server_threads::count());
+    }
+}
+
+static void
+start_init(cxx::String const &args)
+{
+  start_server_threads();
+  elf_loader.start(_init_prog, args);
+}
+
 
 static void init_env()
 {
@@ -547,7 +843,9 @@ int main(int /* argc */, char** /* argv */)
     {
       map_kip();
       init_utcb();
+      Moe::Server_threads::add(L4::Cap<L4::Thread>(L4_BASE_THREAD_CAP));
       Moe::Boot_fs::init_stage1();
+      parse_early_options();
       find_memory();
       init_virt_limits();
 #if 0
@@ -596,14 +894,13 @@ int main(int /* argc */, char** /* argv */)
 
           if (a.first[0] != '-') // not an option start init
             {
-              elf_loader.start(_init_prog, cxx::String(a.first.start(),
-                                                       a.second.end()));
+              start_init(cxx::String(a.first.start(), a.second.end()));
               break;
             }
 
           if (a.first == "--")
             {
-              elf_loader.start(_init_prog, a.second);
+              start_init(a.second);
               break;
             }
 
@@ -611,7 +908,7 @@ int main(int /* argc */, char** /* argv */)
         }
 
       if (a.first.empty())
-        elf_loader.start(_init_prog, cxx::String(""));
+        start_init(cxx::String(""));
 
       // dump name space information
       if (boot.is_active())
@@ -13,11 +13,16 @@
 #include <l4/cxx/minmax>
 
 #include "debug.h"
+#include "lock.h"
 #include "malloc.h"
 #include "page_alloc.h"
 
 static Dbg info(Dbg::Info);
 
+// Protects the bins of all containers, they are used by all server threads
+// (for example for exceptions).
+static Moe::Spin_lock malloc_lock;
+
 namespace Moe {
 
 /**
@@ -116,6 +121,7 @@ Moe::Malloc_container::alloc(size_t size, size_t align) noexcept
     printf("Malloc[%p]: alloc(%zu, %zu)\n", this, size, align);
   // make sure alignment will be ok
   size = cxx::max(size, align);
+  Lock_guard<Spin_lock> guard(malloc_lock);
   // now find the next possible 2^n alignment
   size_t outsz = 4;
   while ((1UL << outsz) < size)
@@ -156,6 +162,7 @@ Moe::Malloc_container::free(void *block) noexcept
     printf("Malloc[%p]: free(%p)\n", this, block);
 
   auto *pg = Malloc_page::from_ptr(block);
+  Lock_guard<Spin_lock> guard(malloc_lock);
 
   if (pg->container() != this)
     {
@@ -196,6 +203,7 @@ Moe::Malloc_container::free_mem(void *page)
 void
 Moe::Malloc_container::reparent(Malloc_container *new_container)
 {
+  Lock_guard<Spin_lock> guard(malloc_lock);
   while (!_pages.empty())
     {
       auto *front = _pages.pop_front();
@@ -92,6 +92,38 @@ Entry::set_cap_copy(L4::Cap<L4::Kobject> cap)
 Name_space::~Name_space()
 {
   _tree.remove_all([](Entry *e) { delete e; });
+  if (_buckets)
+    qalloc()->free(_buckets);
+}
+
+/**
+ * Rebuild the hash index with a new number of buckets.
+ *
+ * \retval false  No memory for the buckets, the index is unchanged.
+ */
+bool
+Name_space::rehash(unsigned buckets)
+{
+  auto **b = static_cast<Entry **>(qalloc()->alloc(buckets * sizeof(Entry *),
+                                                   alignof(Entry *)));
+  if (!b)
+    return false;
+
+  memset(b, 0, buckets * sizeof(Entry *));
+  for (auto i = _tree.begin(); i != _tree.end(); ++i)
+    {
+      Entry *e = &*i;
+      Entry **h = &b[e->_hash & (buckets - 1)];
+      e->_hash_next = *h;
+      *h = e;
+    }
+
+  if (_buckets)
+    qalloc()->free(_buckets);
+
+  _buckets = b;
+  _num_buckets = buckets;
+  return true;
 }
 
 Entry *
@@ -181,7 +213,7 @@ Name_space::op_register_obj(L4Re::Namespace::Rights, unsigned flags,
   if (cap.id_received())
     n->set_epiface(cap.data());
   else if (cap.cap_received())
-    n->set_cap_copy(L4::Cap<L4::Kobject>(Rcv_cap << L4_CAP_SHIFT));
+    n->set_cap_copy(L4::cap_cast<L4::Kobject>(::rcv_cap()));
   else if (cap.is_valid())
     // received a valid cap we cannot handle
     return -L4_EINVAL;
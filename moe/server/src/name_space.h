@@ -57,6 +57,9 @@ private:
   typedef cxx::Weak_ref<Moe::Server_object> Weak_ref;
   Name _name;
   unsigned _flags;
+  unsigned _hash;
+  /// Next entry in the hash bucket of the name space.
+  Entry *_hash_next = 0;
   union
   {
     l4_cap_idx_t _cap;
@@ -78,10 +81,26 @@ public:
     memcpy(namecpy, name, len);
     namecpy[len] = 0;
     _name = Name(namecpy, len);
+    _hash = hash(namecpy, len);
   }
 
   ~Entry();
 
+  /// Hash of a name (FNV-1a).
+  static unsigned hash(char const *name, unsigned long len)
+  {
+    unsigned h = 2166136261U;
+    for (unsigned long i = 0; i < len; ++i)
+      h = (h ^ static_cast<unsigned char>(name[i])) * 16777619U;
+    return h;
+  }
+
+  bool has_name(Name const &name, unsigned hash) const
+  {
+    return _hash == hash && _name.len() == name.len()
+           && !memcmp(_name.start(), name.start(), name.len());
+  }
+
   Name const &name() const
   { return _name; }
 
@@ -144,16 +163,77 @@ class Name_space :
   friend class Entry;
   typedef cxx::Avl_tree<Entry, Entry_get_key, Entry_key_compare> Tree;
   typedef L4::Ipc::Array_in_buf<char, unsigned long> Name_buffer;
+
+  enum
+  {
+    Min_buckets = 16,
+    /// Largest bucket array that fits into a single allocation.
+    Max_buckets = 1024 / sizeof(Entry *),
+  };
+
+  /*
+   * The tree keeps the entries sorted for iteration, lookups use the hash
+   * index. Without a bucket array, e.g. when it could not be allocated,
+   * lookups fall back to the tree.
+   */
   Tree _tree;
+  Entry **_buckets = 0;
+  unsigned _num_buckets = 0;
+  unsigned _num_entries = 0;
 
   Entry *find(Entry::Name const &name) const
-  { return _tree.find_node(name); }
+  {
+    if (!_buckets)
+      return _tree.find_node(name);
+
+    unsigned h = Entry::hash(name.start(), name.len());
+    for (Entry *e = _buckets[h & (_num_buckets - 1)]; e; e = e->_hash_next)
+      if (e->has_name(name, h))
+        return e;
+
+    return 0;
+  }
 
   Entry *remove(Entry::Name const &name)
-  { return _tree.remove(name); }
+  {
+    Entry *e = _tree.remove(name);
+    if (!e)
+      return 0;
+
+    --_num_entries;
+    if (_buckets)
+      for (Entry **p = &_buckets[e->_hash & (_num_buckets - 1)]; *p;
+           p = &(*p)->_hash_next)
+        if (*p == e)
+          {
+            *p = e->_hash_next;
+            break;
+          }
+
+    return e;
+  }
 
   bool insert(Entry *e)
-  { return _tree.insert(e).second; }
+  {
+    if (!_tree.insert(e).second)
+      return false;
+
+    ++_num_entries;
+    if (_num_entries > _num_buckets && _num_buckets < Max_buckets
+        && rehash(_num_buckets ? _num_buckets * 2 : unsigned(Min_buckets)))
+      return true;
+
+    if (_buckets)
+      {
+        Entry **b = &_buckets[e->_hash & (_num_buckets - 1)];
+        e->_hash_next = *b;
+        *b = e;
+      }
+
+    return true;
+  }
+
+  bool rehash(unsigned buckets);
 
   Entry *check_existing(Name_buffer const &name, unsigned flags);
 
@@ -23,6 +23,7 @@
 
 #include "early.h"
 #include "server_obj.h"
+#include "server_threads.h"
 
 #include <cstring>
 #include <cassert>
@@ -32,9 +33,17 @@
 
 enum
 {
+  /// First receive capability slot, one per server thread.
   Rcv_cap = 0x100,
 };
 
+/// Receive capability slot of the calling server thread.
+inline L4::Cap<void> rcv_cap()
+{
+  return L4::Cap<void>((Rcv_cap + Moe::Server_threads::self())
+                       << L4_CAP_SHIFT);
+}
+
 class Cap_alloc;
 
 class Object_pool
@@ -62,7 +71,7 @@ public:
   L4::Cap<void> get_rcv_cap(int index) const override
   {
     if (index == 0)
-      return L4::Cap<void>(Rcv_cap << L4_CAP_SHIFT);
+      return ::rcv_cap();
     else
       return L4::Cap<void>::Invalid;
   }
@@ -98,7 +107,7 @@ public:
   enum
   {
     Non_gc_caps = 8192,
-    Non_gc_cap_0 = Rcv_cap + 1,
+    Non_gc_cap_0 = Rcv_cap + Moe::Server_threads::Max_threads,
   };
 
 private:
@@ -136,7 +145,7 @@ public:
 
     l4_umword_t id = l4_umword_t(o);
     l4_factory_create_gate(L4_BASE_FACTORY_CAP, cap.cap(),
-                           L4_BASE_THREAD_CAP, id);
+                           Moe::Server_threads::gate_thread().cap(), id);
 
     _o->set_server(&object_pool, cap, true);
     return cap;
@@ -9,11 +9,15 @@
 #include <l4/util/util.h>
 
 #include <l4/cxx/iostream>
-#include <l4/cxx/list_alloc>
 #include <l4/cxx/exceptions>
+#include <l4/cxx/minmax>
 #include <l4/sys/kdebug.h>
+#include <l4/sys/cache.h>
+#include <cstring>
 #include "page_alloc.h"
+#include "seg_fit_alloc.h"
 #include "debug.h"
+#include "lock.h"
 
 #if 1
 enum { page_alloc_debug = 0 };
@@ -21,7 +25,7 @@ enum { page_alloc_debug = 0 };
 unsigned page_alloc_debug = 0;
 #endif
 
-class LA : public cxx::List_alloc
+class LA : public Seg_fit_alloc
 {
 #if 0
 public:
@@ -35,7 +39,7 @@ public:
   void *alloc(unsigned long size, unsigned long align)
   {
     L4::cout << "PA::alloc: " << L4::hex << size << '(' << align << ") -> \n";
-    void *p = cxx::List_alloc::alloc(size, align);
+    void *p = Seg_fit_alloc::alloc(size, align);
     L4::cout << p << "\n";
     return p;
   }
@@ -45,41 +49,388 @@ public:
   void free(void *p, unsigned long size)
   {
     L4::cout << "free: " << p << '(' << size << ") -> ";
-    cxx::List_alloc::free(p, size);
+    Seg_fit_alloc::free(p, size);
     L4::cout << avail() << "\n";
   }
 #endif
 };
 
-static LA *page_alloc()
+namespace {
+
+/**
+ * Physical memory of Moe, split into NUMA nodes.
+ *
+ * Each node has its own allocator. Memory outside of the configured node
+ * ranges, and all memory if there is no NUMA configuration, belongs to
+ * node 0. Allocations try the requested node first and then the other
+ * nodes in order.
+ */
+class Node_pools
 {
-  static LA pa;
+public:
+  enum
+  {
+    Max_nodes  = Single_page_alloc_base::Max_nodes,
+    Max_ranges = 16,
+    Any_node   = Single_page_alloc_base::Any_node,
+  };
+
+  bool add_range(unsigned node, l4_addr_t start, l4_addr_t end)
+  {
+    if (node >= Max_nodes || _num_ranges >= Max_ranges || start >= end)
+      return false;
+
+    _ranges[_num_ranges++] = Range{start, end, node};
+    if (node >= _nodes)
+      _nodes = node + 1;
+    return true;
+  }
+
+  unsigned nodes() const { return _nodes; }
+
+  unsigned node_of(l4_addr_t a) const
+  {
+    for (unsigned i = 0; i < _num_ranges; ++i)
+      if (a >= _ranges[i].start && a < _ranges[i].end)
+        return _ranges[i].node;
+
+    return 0;
+  }
+
+  /// Free memory, fresh memory is split at the node boundaries.
+  void free(void *p, unsigned long size, bool initial_mem = false)
+  {
+    l4_addr_t a = reinterpret_cast<l4_addr_t>(p);
+    l4_addr_t const end = a + size;
+    while (a < end)
+      {
+        l4_addr_t e = end;
+        if (initial_mem)
+          e = cxx::min(e, next_boundary(a));
+
+        unsigned n = node_of(a);
+        _pools[n].free(reinterpret_cast<void *>(a), e - a, initial_mem);
+        if (initial_mem)
+          _total[n] += e - a;
+        a = e;
+      }
+  }
+
+  void *alloc(unsigned long size, unsigned long align,
+              unsigned node = Any_node)
+  {
+    if (node < _nodes)
+      if (void *r = _pools[node].alloc(size, align))
+        return r;
+
+    for (unsigned n = 0; n < _nodes; ++n)
+      if (n != node)
+        if (void *r = _pools[n].alloc(size, align))
+          return r;
+
+    return 0;
+  }
+
+  void *alloc_max(unsigned long min, unsigned long *max, unsigned align,
+                  unsigned granularity, unsigned node = Any_node)
+  {
+    unsigned long m = *max;
+    if (node < _nodes)
+      if (void *r = _pools[node].alloc_max(min, max, align, granularity))
+        return r;
+
+    for (unsigned n = 0; n < _nodes; ++n)
+      if (n != node)
+        {
+          *max = m;
+          if (void *r = _pools[n].alloc_max(min, max, align, granularity))
+            return r;
+        }
+
+    return 0;
+  }
+
+  unsigned long avail() const
+  {
+    unsigned long a = 0;
+    for (unsigned n = 0; n < _nodes; ++n)
+      a += _pools[n].avail();
+    return a;
+  }
+
+  unsigned long avail(unsigned node) const { return _pools[node].avail(); }
+  unsigned long total(unsigned node) const { return _total[node]; }
+
+  template<typename DBG>
+  void dump_free_list(DBG &out)
+  {
+    for (unsigned n = 0; n < _nodes; ++n)
+      {
+        if (_nodes > 1)
+          out.printf("node %u:\n", n);
+        _pools[n].dump_free_list(out);
+      }
+  }
+
+private:
+  struct Range
+  {
+    l4_addr_t start;
+    l4_addr_t end;
+    unsigned node;
+  };
+
+  /// Smallest range boundary above `a`.
+  l4_addr_t next_boundary(l4_addr_t a) const
+  {
+    l4_addr_t b = ~0UL;
+    for (unsigned i = 0; i < _num_ranges; ++i)
+      {
+        if (_ranges[i].start > a && _ranges[i].start < b)
+          b = _ranges[i].start;
+        if (_ranges[i].end > a && _ranges[i].end < b)
+          b = _ranges[i].end;
+      }
+    return b;
+  }
+
+  LA _pools[Max_nodes];
+  unsigned long _total[Max_nodes] = {};
+  Range _ranges[Max_ranges];
+  unsigned _num_ranges = 0;
+  unsigned _nodes = 1;
+};
+
+}
+
+static Node_pools *page_alloc()
+{
+  static Node_pools pa;
   return &pa;
 }
 
+// Protects the page allocator and the zero pool.
+static Moe::Spin_lock page_alloc_lock;
+typedef Moe::Lock_guard<Moe::Spin_lock> Guard;
+
+namespace {
+
+/**
+ * Pool of zero-filled pages that are clean in the data cache.
+ *
+ * The pool takes the zeroing of fresh pages out of the page-fault path.
+ * Moe refills the pool and scrubs freed pages while it is idle, see
+ * Loop_hooks in main.cc.
+ */
+class Zero_pool
+{
+public:
+  enum
+  {
+    Max_pages = 1024,
+    Batch     = 8,
+  };
+
+  void *take(unsigned node)
+  {
+    if (!_zeroed)
+      {
+        _refill = true;
+        return 0;
+      }
+
+    // the pool is shared by all nodes, search for a page of the right one
+    if (node != Single_page_alloc_base::Any_node)
+      {
+        unsigned long i = _zeroed;
+        while (i
+               && page_alloc()->node_of(
+                    reinterpret_cast<l4_addr_t>(_pages[i - 1])) != node)
+          --i;
+
+        if (!i)
+          return 0;
+
+        void *t = _pages[i - 1];
+        _pages[i - 1] = _pages[_zeroed - 1];
+        _pages[_zeroed - 1] = t;
+      }
+
+    void *p = _pages[--_zeroed];
+    if (_zeroed < _low)
+      _refill = true;
+
+    return p;
+  }
+
+  void put_dirty(void *p)
+  {
+    if (_zeroed + _dirty_cnt >= _high)
+      {
+        page_alloc()->free(p, L4_PAGESIZE);
+        freed();
+        return;
+      }
+
+    Dirty_page *d = static_cast<Dirty_page *>(p);
+    d->next = _dirty;
+    _dirty = d;
+    ++_dirty_cnt;
+  }
+
+  bool pending() const
+  { return _dirty || (_refill && _zeroed < _high); }
+
+  /**
+   * Memory went back to the page allocator.
+   *
+   * A refill that stopped because no page could be allocated is tried
+   * again.
+   */
+  void freed()
+  {
+    if (_zeroed < _low)
+      _refill = true;
+  }
+
+  /**
+   * Scrub a batch of pages.
+   *
+   * Must be called without holding page_alloc_lock, the pages are zeroed
+   * outside of the lock.
+   */
+  void scrub()
+  {
+    for (unsigned i = 0; i < Batch; ++i)
+      {
+        void *p;
+          {
+            Guard g(page_alloc_lock);
+            if (!pending())
+              break;
+
+            if (_dirty)
+              {
+                p = _dirty;
+                _dirty = _dirty->next;
+                --_dirty_cnt;
+              }
+            else
+              {
+                // The free memory may consist of fragments smaller than a
+                // page only, wait for the next free before trying again.
+                p = page_alloc()->alloc(L4_PAGESIZE, L4_PAGESIZE);
+                if (!p)
+                  {
+                    _refill = false;
+                    break;
+                  }
+              }
+          }
+
+        memset(p, 0, L4_PAGESIZE);
+        // No need for I cache coherence, as we just zero fill and assume that
+        // this is no executable code
+        l4_cache_clean_data(reinterpret_cast<l4_addr_t>(p),
+                            reinterpret_cast<l4_addr_t>(p) + L4_PAGESIZE);
+
+        Guard g(page_alloc_lock);
+        if (_zeroed >= _high)
+          page_alloc()->free(p, L4_PAGESIZE);
+        else
+          _pages[_zeroed++] = p;
+      }
+
+    Guard g(page_alloc_lock);
+    if (_zeroed >= _high)
+      _refill = false;
+  }
+
+  /// Return all pooled pages to the page allocator.
+  bool reclaim()
+  {
+    if (!_zeroed && !_dirty)
+      return false;
+
+    while (_zeroed)
+      page_alloc()->free(_pages[--_zeroed], L4_PAGESIZE);
+
+    for (; _dirty; --_dirty_cnt)
+      {
+        void *p = _dirty;
+        _dirty = _dirty->next;
+        page_alloc()->free(p, L4_PAGESIZE);
+      }
+
+    return true;
+  }
+
+  unsigned long pages() const { return _zeroed + _dirty_cnt; }
+
+  void watermarks(unsigned long low, unsigned long high)
+  {
+    _high = cxx::min<unsigned long>(high, Max_pages);
+    _low = low < _high ? low : _high;
+    _refill = true;
+
+    while (_zeroed > _high)
+      page_alloc()->free(_pages[--_zeroed], L4_PAGESIZE);
+  }
+
+private:
+  struct Dirty_page { Dirty_page *next; };
+
+  void *_pages[Max_pages] = {};
+  unsigned long _zeroed = 0;
+  Dirty_page *_dirty = 0;
+  unsigned long _dirty_cnt = 0;
+  unsigned long _low = 64;
+  unsigned long _high = 256;
+  bool _refill = true;
+};
+
+static Zero_pool zero_pool;
+
+}
+
 Single_page_alloc_base::Single_page_alloc_base()
 {}
 
 unsigned long Single_page_alloc_base::_avail()
 {
-  return page_alloc()->avail();
+  Guard g(page_alloc_lock);
+  // pooled pages are given back on demand
+  return page_alloc()->avail() + zero_pool.pages() * L4_PAGESIZE;
 }
 
 void *Single_page_alloc_base::_alloc_max(unsigned long min,
                                          unsigned long *max,
                                          unsigned align,
-                                         unsigned granularity)
+                                         unsigned granularity,
+                                         unsigned node)
 {
-  void *ret = page_alloc()->alloc_max(min, max, align, granularity);
+  Guard g(page_alloc_lock);
+  unsigned long m = *max;
+  void *ret = page_alloc()->alloc_max(min, max, align, granularity, node);
+  if (!ret && zero_pool.reclaim())
+    {
+      *max = m;
+      ret = page_alloc()->alloc_max(min, max, align, granularity, node);
+    }
+
   if (page_alloc_debug)
     L4::cout << "pa(" << __builtin_return_address(0) << "): alloc(" << *max << ") @" << ret << '\n';
   return ret;
 }
 
 void *Single_page_alloc_base::_alloc(Nothrow, unsigned long size,
-                                     unsigned long align)
+                                     unsigned long align, unsigned node)
 {
-  void *ret = page_alloc()->alloc(size, align);
+  Guard g(page_alloc_lock);
+  void *ret = page_alloc()->alloc(size, align, node);
+  if (!ret && zero_pool.reclaim())
+    ret = page_alloc()->alloc(size, align, node);
+
   if (page_alloc_debug)
     L4::cout << "pa(" << __builtin_return_address(0) << "): alloc(" << size << ") @" << ret << '\n';
   return ret;
@@ -89,12 +440,93 @@ void Single_page_alloc_base::_free(void *p, unsigned long size, bool initial_mem
 {
   if (page_alloc_debug)
     L4::cout << "pa(" << __builtin_return_address(0) << "): free(" << size << ") @" << p << '\n';
+  Guard g(page_alloc_lock);
   page_alloc()->free(p, size, initial_mem);
+  zero_pool.freed();
+}
+
+void *Single_page_alloc_base::_alloc_zeroed_page(Nothrow, unsigned node)
+{
+  void *ret;
+    {
+      Guard g(page_alloc_lock);
+      ret = zero_pool.take(node);
+    }
+
+  if (ret)
+    return ret;
+
+  ret = _alloc(nothrow, L4_PAGESIZE, L4_PAGESIZE, node);
+  if (!ret)
+    return 0;
+
+  memset(ret, 0, L4_PAGESIZE);
+  // No need for I cache coherence, as we just zero fill and assume that
+  // this is no executable code
+  l4_cache_clean_data(reinterpret_cast<l4_addr_t>(ret),
+                      reinterpret_cast<l4_addr_t>(ret) + L4_PAGESIZE);
+  return ret;
+}
+
+void Single_page_alloc_base::_free_dirty_page(void *p)
+{
+  if (page_alloc_debug)
+    L4::cout << "pa(" << __builtin_return_address(0) << "): free dirty @" << p << '\n';
+  Guard g(page_alloc_lock);
+  zero_pool.put_dirty(p);
+}
+
+void Single_page_alloc_base::_zero_pool_watermarks(unsigned long low,
+                                                   unsigned long high)
+{
+  Guard g(page_alloc_lock);
+  zero_pool.watermarks(low, high);
+}
+
+bool Single_page_alloc_base::_scrub_pending()
+{
+  Guard g(page_alloc_lock);
+  return zero_pool.pending();
+}
+
+void Single_page_alloc_base::_scrub()
+{ zero_pool.scrub(); }
+
+bool Single_page_alloc_base::_add_node_range(unsigned node, l4_addr_t start,
+                                             l4_addr_t end)
+{
+  Guard g(page_alloc_lock);
+  return page_alloc()->add_range(node, start, end);
+}
+
+unsigned Single_page_alloc_base::_num_nodes()
+{
+  Guard g(page_alloc_lock);
+  return page_alloc()->nodes();
+}
+
+unsigned Single_page_alloc_base::_node_of(void const *p)
+{
+  Guard g(page_alloc_lock);
+  return page_alloc()->node_of(reinterpret_cast<l4_addr_t>(p));
+}
+
+unsigned long Single_page_alloc_base::_node_avail(unsigned node)
+{
+  Guard g(page_alloc_lock);
+  return node < page_alloc()->nodes() ? page_alloc()->avail(node) : 0;
+}
+
+unsigned long Single_page_alloc_base::_node_total(unsigned node)
+{
+  Guard g(page_alloc_lock);
+  return node < page_alloc()->nodes() ? page_alloc()->total(node) : 0;
 }
 
 #ifndef NDEBUG
 void Single_page_alloc_base::_dump_free(Dbg &dbg)
 {
+  Guard g(page_alloc_lock);
   page_alloc()->dump_free_list(dbg);
 }
 #endif
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <l4/cxx/exceptions>
+#include <l4/sys/l4int.h>
 
 class Dbg;
 
@@ -22,16 +23,31 @@ class Single_page_alloc_base
 public:
   enum Nothrow { nothrow };
 
+  enum
+  {
+    /// Maximum number of NUMA nodes.
+    Max_nodes = 8,
+    /// No node preference, take memory from any node.
+    Any_node  = ~0U,
+  };
+
 protected:
   Single_page_alloc_base();
 
 public:
+  /*
+   * The allocation functions take an optional NUMA node. The memory is
+   * taken from that node if possible and from any other node otherwise.
+   */
   static void *_alloc_max(unsigned long min, unsigned long *max,
-                          unsigned align, unsigned granularity);
-  static void *_alloc(Nothrow, unsigned long size, unsigned long align = 0);
-  static void *_alloc(unsigned long size, unsigned long align = 0)
+                          unsigned align, unsigned granularity,
+                          unsigned node = Any_node);
+  static void *_alloc(Nothrow, unsigned long size, unsigned long align = 0,
+                      unsigned node = Any_node);
+  static void *_alloc(unsigned long size, unsigned long align = 0,
+                      unsigned node = Any_node)
   {
-    void *r = _alloc(nothrow, size, align);
+    void *r = _alloc(nothrow, size, align, node);
     if (!r)
       throw L4::Out_of_memory();
     return r;
@@ -39,6 +55,61 @@ public:
   static void _free(void *p, unsigned long size, bool initial_mem = false);
   static unsigned long _avail();
 
+  /**
+   * Allocate a single zero-filled page that is clean in the data cache.
+   *
+   * The page is taken from the pool of pre-zeroed pages if possible.
+   */
+  static void *_alloc_zeroed_page(Nothrow, unsigned node = Any_node);
+  static void *_alloc_zeroed_page(unsigned node = Any_node)
+  {
+    void *r = _alloc_zeroed_page(nothrow, node);
+    if (!r)
+      throw L4::Out_of_memory();
+    return r;
+  }
+
+  /**
+   * Free a single page, its content is scrubbed in the background.
+   */
+  static void _free_dirty_page(void *p);
+
+  /**
+   * Configure the pool of pre-zeroed pages.
+   *
+   * \param low   The pool is refilled when it drops below `low` pages.
+   * \param high  Maximum number of pages in the pool.
+   */
+  static void _zero_pool_watermarks(unsigned long low, unsigned long high);
+
+  /// Check whether there are pages to scrub or to add to the zero pool.
+  static bool _scrub_pending();
+
+  /// Scrub a small batch of pages, to be called when Moe is idle.
+  static void _scrub();
+
+  /**
+   * Assign the physical memory `[start, end)` to a NUMA node.
+   *
+   * Must be called before the memory is given to the allocator. Memory
+   * outside of all ranges belongs to node 0.
+   *
+   * \retval false  Invalid node or range, or too many ranges.
+   */
+  static bool _add_node_range(unsigned node, l4_addr_t start, l4_addr_t end);
+
+  /// Number of NUMA nodes, 1 without NUMA configuration.
+  static unsigned _num_nodes();
+
+  /// NUMA node of the physical memory at `p`.
+  static unsigned _node_of(void const *p);
+
+  /// Free memory of a NUMA node in bytes.
+  static unsigned long _node_avail(unsigned node);
+
+  /// Memory of a NUMA node in bytes, free or in use.
+  static unsigned long _node_total(unsigned node);
+
 #ifndef NDEBUG
   static void _dump_free(Dbg &dbg);
 #endif
@@ -20,6 +20,7 @@
 #include <cstdio>
 #include <cassert>
 
+#include "lock.h"
 #include "malloc.h"
 #include "page_alloc.h"
 
@@ -27,6 +28,8 @@ namespace Moe {
 
 /**
  * A simple quota manager.
+ *
+ * Safe to use from all server threads.
  */
 class Quota
 {
@@ -34,6 +37,7 @@ public:
   explicit Quota(size_t limit) : _limit(limit), _used(0) {}
   bool alloc(size_t s)
   {
+    Lock_guard<Spin_lock> g(_lock);
     if (_limit && (s > _limit || _used > _limit - s))
       return false;
 
@@ -44,6 +48,7 @@ public:
 
   void free(size_t s)
   {
+    Lock_guard<Spin_lock> g(_lock);
     assert(s <= _used);
     _used -= s;
     //printf("Q: free(%zx) -> %zx\n", s, _used);
@@ -55,6 +60,7 @@ public:
 private:
   size_t _limit;
   size_t _used;
+  Spin_lock _lock;
 };
 
 /**
@@ -119,10 +125,32 @@ public:
 
   Quota *quota() { return &_quota; }
 
-  void *alloc_pages(unsigned long size, unsigned long align)
+  void *alloc_pages(unsigned long size, unsigned long align,
+                    unsigned node = Single_page_alloc_base::Any_node)
   {
     Quota_guard g(quota(), size);
-    return g.release(Single_page_alloc_base::_alloc(size, align));
+    return g.release(Single_page_alloc_base::_alloc(size, align, node));
+  }
+
+  /**
+   * Allocate pages without throwing.
+   *
+   * \return Pointer to the pages, NULL if either the quota or the free
+   *         memory is exhausted.
+   */
+  void *alloc_pages(Single_page_alloc_base::Nothrow, unsigned long size,
+                    unsigned long align,
+                    unsigned node = Single_page_alloc_base::Any_node) noexcept
+  {
+    if (!quota()->alloc(size))
+      return 0;
+
+    void *p = Single_page_alloc_base::_alloc(Single_page_alloc_base::nothrow,
+                                             size, align, node);
+    if (!p)
+      quota()->free(size);
+
+    return p;
   }
 
   void free_pages(void *p, unsigned long size) noexcept
@@ -131,6 +159,24 @@ public:
     quota()->free(size);
   }
 
+  /**
+   * Allocate a single zero-filled page that is clean in the data cache.
+   */
+  void *alloc_zeroed_page(unsigned node = Single_page_alloc_base::Any_node)
+  {
+    Quota_guard g(quota(), L4_PAGESIZE);
+    return g.release(Single_page_alloc_base::_alloc_zeroed_page(node));
+  }
+
+  /**
+   * Free a single page whose content must be scrubbed before reuse.
+   */
+  void free_dirty_page(void *p) noexcept
+  {
+    Single_page_alloc_base::_free_dirty_page(p);
+    quota()->free(L4_PAGESIZE);
+  }
+
   void reparent(Malloc_container *new_container) override;
 
 protected:
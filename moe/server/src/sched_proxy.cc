@@ -168,7 +168,7 @@ Sched_proxy::received_thread(L4::Ipc::Snd_fpage const &fp)
   if (!fp.cap_received())
     return L4::Cap<L4::Thread>::Invalid;
 
-  return L4::Cap<L4::Thread>(Rcv_cap << L4_CAP_SHIFT);
+  return L4::cap_cast<L4::Thread>(::rcv_cap());
 }
 
 void
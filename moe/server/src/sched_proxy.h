@@ -48,7 +48,7 @@ public:
 
   L4::Cap<L4::Thread> received_thread(L4::Ipc::Snd_fpage const &fp);
   L4::Cap<void> rcv_cap() const
-  { return L4::Cap<L4::Thread>(Rcv_cap << L4_CAP_SHIFT); }
+  { return ::rcv_cap(); }
 
   void restrict_cpus(l4_umword_t cpus);
   void rescan_cpus_and_classes();
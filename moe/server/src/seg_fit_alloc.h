@@ -0,0 +1,415 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/cxx/arith>
+#include <l4/cxx/avl_tree>
+#include <l4/cxx/hlist>
+#include <l4/cxx/minmax>
+#include <l4/sys/consts.h>
+
+#include <new>
+
+/**
+ * Segregated-fit allocator for Moe's physical memory.
+ *
+ * Free blocks are kept in two structures:
+ *  - one free list per size class, where class `c` holds all blocks of size
+ *    `[2^c, 2^(c+1))`, with a bitmap of the non-empty classes, and
+ *  - an AVL tree ordered by block address that is used to find the neighbours
+ *    of a block for coalescing.
+ *
+ * Allocation picks the first block of the smallest size class that is
+ * guaranteed to fit the request, so it does not depend on the number of free
+ * blocks. Freeing a block and coalescing it with its neighbours is
+ * O(log n). The interface matches cxx::List_alloc, which walked the whole
+ * address-ordered free list on every allocation and free.
+ *
+ * The management data of a free block is stored in the block itself, so the
+ * allocator has no additional memory requirements.
+ */
+class Seg_fit_alloc
+{
+private:
+  struct Block : cxx::Avl_tree_node, cxx::H_list_item_t<Block>
+  {
+    explicit Block(unsigned long size) : size(size) {}
+
+    unsigned long start() const
+    { return reinterpret_cast<unsigned long>(this); }
+
+    unsigned long end() const
+    { return start() + size; }
+
+    unsigned long size;
+  };
+
+  struct Block_get_key
+  {
+    typedef unsigned long Key_type;
+    static Key_type key_of(Block const *b) { return b->start(); }
+  };
+
+  /**
+   * Reverse address order, makes lower_bound_node() return the block at
+   * or directly below a given address.
+   */
+  struct Block_key_compare
+  {
+    bool operator () (unsigned long l, unsigned long r) const
+    { return l > r; }
+  };
+
+  typedef cxx::Avl_tree<Block, Block_get_key, Block_key_compare> Tree;
+  typedef cxx::H_list_t<Block> Free_list;
+
+  enum
+  {
+    /// Smallest managed unit, the size of Block rounded up to a power of 2.
+    Min_shift = cxx::arith::Ld<2 * sizeof(Block) - 1>::value,
+    Min_size  = 1UL << Min_shift,
+    Num_classes = sizeof(unsigned long) * 8,
+  };
+
+  Tree _tree;
+  Free_list _classes[Num_classes];
+  unsigned long _nonempty = 0;
+  unsigned long _avail = 0;
+
+  static unsigned size_class(unsigned long size)
+  { return sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size); }
+
+  /// Smallest class whose blocks are all at least `size` bytes large.
+  static unsigned fit_class(unsigned long size)
+  {
+    unsigned c = size_class(size);
+    return (size & (size - 1)) ? c + 1 : c;
+  }
+
+  void enqueue(Block *b)
+  {
+    unsigned c = size_class(b->size);
+    _classes[c].add(b);
+    _nonempty |= 1UL << c;
+  }
+
+  void dequeue(Block *b)
+  {
+    unsigned c = size_class(b->size);
+    Free_list::remove(b);
+    if (_classes[c].empty())
+      _nonempty &= ~(1UL << c);
+  }
+
+  /// First non-empty class `>= c`, or Num_classes if there is none.
+  unsigned first_class(unsigned c) const
+  {
+    if (c >= Num_classes)
+      return Num_classes;
+
+    unsigned long m = _nonempty & (~0UL << c);
+    return m ? __builtin_ctzl(m) : Num_classes;
+  }
+
+  /**
+   * Size remaining in `b` after aligning the start according to `almask`.
+   *
+   * \return Usable size, 0 if the alignment padding exceeds the block.
+   */
+  static unsigned long usable(Block const *b, unsigned long almask,
+                              unsigned long *a_start)
+  {
+    *a_start = (b->start() + almask) & ~almask;
+    if (*a_start - b->start() >= b->size)
+      return 0;
+
+    return b->end() - *a_start;
+  }
+
+  /**
+   * Cut `[a_start, a_start + size)` out of the free block `b`.
+   *
+   * Leading and trailing remainders stay in the allocator.
+   */
+  void *carve(Block *b, unsigned long a_start, unsigned long size)
+  {
+    unsigned long b_end = b->end();
+    dequeue(b);
+
+    if (a_start > b->start())
+      {
+        b->size = a_start - b->start();
+        enqueue(b);
+      }
+    else
+      _tree.remove(b->start());
+
+    unsigned long a_end = a_start + size;
+    if (a_end < b_end)
+      {
+        Block *t = new (reinterpret_cast<void *>(a_end)) Block(b_end - a_end);
+        _tree.insert(t);
+        enqueue(t);
+      }
+
+    _avail -= size;
+    return reinterpret_cast<void *>(a_start);
+  }
+
+  static unsigned long min_almask(unsigned long align)
+  {
+    unsigned long almask = align ? (align - 1UL) : 0;
+    return cxx::max<unsigned long>(almask, Min_size - 1);
+  }
+
+  inline void check_overlap(unsigned long start, unsigned long size);
+
+public:
+  Seg_fit_alloc() = default;
+
+  /**
+   * Return a free memory block to the allocator.
+   *
+   * \param block        Pointer to memory block.
+   * \param size         Size of memory block.
+   * \param initial_free Set to true for putting fresh memory
+   *                     to the allocator. This will enforce alignment on that
+   *                     memory.
+   */
+  inline void free(void *block, unsigned long size, bool initial_free = false);
+
+  /**
+   * Allocate a memory block.
+   *
+   * \param size  Size of the memory block.
+   * \param align Alignment constraint.
+   *
+   * \return  Pointer to memory block, NULL if there is no suitable block.
+   */
+  inline void *alloc(unsigned long size, unsigned long align);
+
+  /**
+   * Allocate a memory block of `min` <= size <= `max`.
+   *
+   * \param         min          Minimal size to allocate (in bytes).
+   * \param[in,out] max          Maximum size to allocate (in bytes). The actual
+   *                             allocated size is returned here.
+   * \param         align        Alignment constraint.
+   * \param         granularity  Granularity to use for the allocation (power
+   *                             of 2).
+   *
+   * \return  Pointer to memory block, NULL if there is no suitable block.
+   */
+  inline void *alloc_max(unsigned long min, unsigned long *max,
+                         unsigned long align, unsigned granularity);
+
+  /**
+   * Get the amount of available memory.
+   *
+   * \return Available memory in bytes
+   */
+  unsigned long avail() const { return _avail; }
+
+  template <typename DBG>
+  void dump_free_list(DBG &out);
+};
+
+#if !defined (SEG_FIT_ALLOC_SANITY)
+void
+Seg_fit_alloc::check_overlap(unsigned long, unsigned long)
+{}
+#else
+void
+Seg_fit_alloc::check_overlap(unsigned long start, unsigned long size)
+{
+  Block *p = _tree.lower_bound_node(start + size - 1);
+  if (p && p->end() > start)
+    L4::cerr << "Seg_fit_alloc(FATAL): trying to free memory that "
+                "is already free: \n  ["
+             << reinterpret_cast<void *>(start) << '-'
+             << reinterpret_cast<void *>(start + size) << ") overlaps ["
+             << reinterpret_cast<void *>(p->start()) << '-'
+             << reinterpret_cast<void *>(p->end()) << ")\n";
+}
+#endif
+
+void
+Seg_fit_alloc::free(void *block, unsigned long size, bool initial_free)
+{
+  unsigned long start = reinterpret_cast<unsigned long>(block);
+
+  if (initial_free)
+    {
+      // enforce alignment constraint on initial memory
+      unsigned long nstart = (start + Min_size - 1) & ~(Min_size - 1UL);
+      if (size <= nstart - start)
+        return;
+
+      size = (size - (nstart - start)) & ~(Min_size - 1UL);
+      start = nstart;
+    }
+  else
+    // blow up size to the minimum aligned size
+    size = (size + Min_size - 1) & ~(Min_size - 1UL);
+
+  if (!size)
+    return;
+
+  check_overlap(start, size);
+  _avail += size;
+
+  Block *b;
+  Block *pred = _tree.lower_bound_node(start);
+  if (pred && pred->end() == start)
+    {
+      dequeue(pred);
+      pred->size += size;
+      b = pred;
+    }
+  else
+    {
+      b = new (reinterpret_cast<void *>(start)) Block(size);
+      _tree.insert(b);
+    }
+
+  Block *succ = _tree.find_node(b->end());
+  if (succ)
+    {
+      dequeue(succ);
+      _tree.remove(succ->start());
+      b->size += succ->size;
+    }
+
+  enqueue(b);
+}
+
+void *
+Seg_fit_alloc::alloc(unsigned long size, unsigned long align)
+{
+  if (!size || size > ~0UL - Min_size)
+    return 0;
+
+  // blow up size to the minimum aligned size
+  size = (size + Min_size - 1) & ~(Min_size - 1UL);
+
+  unsigned long almask = min_almask(align);
+  unsigned long a_start;
+
+  // All blocks are Min_size aligned, so this is the worst-case padding.
+  unsigned long pad = almask - (Min_size - 1);
+  if (size <= ~0UL - pad)
+    {
+      // Fast path: every block in this class or above fits the request.
+      unsigned c = first_class(fit_class(size + pad));
+      if (c < Num_classes)
+        {
+          Block *b = _classes[c].front();
+          usable(b, almask, &a_start);
+          return carve(b, a_start, size);
+        }
+    }
+
+  // Slow path: look for a block that happens to fit in the classes that do
+  // not give any guarantee, e.g. for an exactly sized or luckily aligned
+  // block.
+  unsigned last = size <= ~0UL - pad
+                  ? cxx::min<unsigned>(fit_class(size + pad), Num_classes)
+                  : unsigned(Num_classes);
+  for (unsigned c = first_class(size_class(size)); c < last;
+       c = first_class(c + 1))
+    for (Block *b: _classes[c])
+      if (usable(b, almask, &a_start) >= size)
+        return carve(b, a_start, size);
+
+  return 0;
+}
+
+void *
+Seg_fit_alloc::alloc_max(unsigned long min, unsigned long *max,
+                         unsigned long align, unsigned granularity)
+{
+  // blow minimum up to at least the minimum aligned size of a Block
+  min = l4_round_size(min, Min_shift);
+  // truncate maximum to at least the size of a Block
+  *max = l4_trunc_size(*max, Min_shift);
+  // truncate maximum size according to granularity
+  *max = *max & ~(granularity - 1UL);
+
+  if (!min || min > *max)
+    return 0;
+
+  if (void *r = alloc(*max, align))
+    return r;
+
+  // There is no block for the maximum size, so take the largest usable one.
+  // Start at the largest class and stop as soon as no block in a class
+  // can beat the best fit found so far.
+  unsigned long almask = min_almask(align);
+  Block *fit = 0;
+  unsigned long fit_start = 0;
+  unsigned long max_fit = 0;
+
+  for (int c = Num_classes - 1; c >= 0; --c)
+    {
+      if (!(_nonempty & (1UL << c)))
+        continue;
+
+      if (c + 1 < Num_classes && (1UL << (c + 1)) <= max_fit)
+        break;
+
+      for (Block *b: _classes[c])
+        {
+          unsigned long a_start;
+          unsigned long r_size = usable(b, almask, &a_start);
+          // round down according to granularity
+          r_size &= ~(granularity - 1UL);
+          if (r_size >= min && r_size > max_fit)
+            {
+              fit = b;
+              fit_start = a_start;
+              max_fit = r_size;
+            }
+        }
+    }
+
+  if (!fit)
+    return 0;
+
+  *max = max_fit;
+  return carve(fit, fit_start, max_fit);
+}
+
+template <typename DBG>
+void
+Seg_fit_alloc::dump_free_list(DBG &out)
+{
+  for (auto i = _tree.rbegin(); i != _tree.rend(); ++i)
+    {
+      Block const *c = &*i;
+      unsigned sz;
+      const char *unit;
+
+      if (c->size < 1024)
+        {
+          sz = c->size;
+          unit = "Byte";
+        }
+      else if (c->size < 1 << 20)
+        {
+          sz = c->size >> 10;
+          unit = "kB";
+        }
+      else
+        {
+          sz = c->size >> 20;
+          unit = "MB";
+        }
+
+      out.printf("%12p - %12p (%u %s) [class %u]\n", c,
+                 reinterpret_cast<char const *>(c) + c->size - 1, sz, unit,
+                 size_class(c->size));
+    }
+}
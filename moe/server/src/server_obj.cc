@@ -1,8 +1,147 @@
 #include "server_obj.h"
 #include "globals.h"
+#include "lock.h"
+#include "quota.h"
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/sys/irq>
 
 static Moe::Null_handler null_handler;
 
+namespace {
+
+/// A deleted object that waits to be freed, stored in its own memory.
+struct Deferred
+{
+  Deferred *next;
+  std::size_t size;
+  unsigned long epoch;
+};
+
+static_assert(sizeof(Deferred) <= sizeof(Moe::Server_object),
+              "Server object too small to be queued for freeing");
+
+typedef Moe::Lock_guard<Moe::Spin_lock> Guard;
+
+// Protects the list of deleted objects and the epoch counter.
+Moe::Spin_lock deferred_lock;
+// Deleted objects, the most recently deleted first.
+Deferred *deferred;
+// Incremented for every deleted object.
+unsigned long epoch;
+// Epoch seen by each server thread at its last dispatch boundary.
+unsigned long seen[Moe::Server_threads::Max_threads];
+
+/// Target of the wakeup IRQs, the dispatch boundary is all that counts.
+struct Wakeup : L4::Irqep_t<Wakeup>
+{
+  void handle_irq() {}
+};
+
+Wakeup wakeup;
+L4::Cap<L4::Irq> wakeup_irq[Moe::Server_threads::Max_threads];
+
+}
+
+void
+Moe::Server_object::operator delete (void *p, std::size_t size) noexcept
+{
+  if (Server_threads::count() <= 1)
+    {
+      Malloc_container::from_ptr(p)->free(p);
+      return;
+    }
+
+  Deferred *d = static_cast<Deferred *>(p);
+  d->size = size;
+
+    {
+      Guard g(deferred_lock);
+      d->epoch = ++epoch;
+      d->next = deferred;
+      __atomic_store_n(&deferred, d, __ATOMIC_RELEASE);
+    }
+
+  unsigned self = Server_threads::self();
+  for (unsigned i = 0; i < Server_threads::count(); ++i)
+    if (i != self && wakeup_irq[i].is_valid())
+      wakeup_irq[i]->trigger();
+}
+
+bool
+Moe::Server_object::is_deleted(L4::Epiface const *o) noexcept
+{
+  if (!__atomic_load_n(&deferred, __ATOMIC_ACQUIRE))
+    return false;
+
+  char const *a = reinterpret_cast<char const *>(o);
+  Guard g(deferred_lock);
+  for (Deferred *d = deferred; d; d = d->next)
+    {
+      char const *s = reinterpret_cast<char const *>(d);
+      if (a >= s && a < s + d->size)
+        return true;
+    }
+
+  return false;
+}
+
+void
+Moe::Server_object::quiescent() noexcept
+{
+  __atomic_store_n(&seen[Server_threads::self()],
+                   __atomic_load_n(&epoch, __ATOMIC_ACQUIRE),
+                   __ATOMIC_RELEASE);
+
+  if (!__atomic_load_n(&deferred, __ATOMIC_ACQUIRE))
+    return;
+
+  Deferred *f;
+    {
+      Guard g(deferred_lock);
+      unsigned long min = epoch;
+      for (unsigned i = 0; i < Server_threads::count(); ++i)
+        {
+          unsigned long s = __atomic_load_n(&seen[i], __ATOMIC_ACQUIRE);
+          if (s < min)
+            min = s;
+        }
+
+      // the list is ordered by descending epochs
+      Deferred **p = &deferred;
+      while (*p && (*p)->epoch > min)
+        p = &(*p)->next;
+
+      f = *p;
+      __atomic_store_n(p, static_cast<Deferred *>(0), __ATOMIC_RELAXED);
+    }
+
+  while (f)
+    {
+      Deferred *n = f->next;
+      Malloc_container::from_ptr(f)->free(f);
+      f = n;
+    }
+}
+
+void
+Moe::Server_object::init_deferred_free()
+{
+  L4::Epiface *w = &wakeup;
+  for (unsigned i = 0; i < Server_threads::count(); ++i)
+    {
+      auto irq = object_pool.cap_alloc()->alloc<L4::Irq>();
+      L4Re::chkcap(irq, "Moe: wakeup IRQ");
+      L4Re::chksys(L4Re::Env::env()->factory()->create(irq),
+                   "Moe: create wakeup IRQ");
+      L4Re::chksys(irq->bind_thread(Server_threads::thread(i),
+                                    l4_umword_t(w)),
+                   "Moe: bind wakeup IRQ");
+      wakeup_irq[i] = irq;
+    }
+}
+
 Moe::Server_object::~Server_object()
 {
   _weak_ptrs.reset();
@@ -19,7 +158,9 @@ Moe::Server_object::~Server_object()
                reinterpret_cast<l4_umword_t>(static_cast<L4::Epiface *>(this)),
                ~0UL,
                reinterpret_cast<l4_umword_t>(static_cast<L4::Epiface *>(&null_handler)));
-      L4::Cap<L4::Thread>(L4_BASE_THREAD_CAP)->modify_senders(todo);
+      // the gate may have been bound to any of the server threads
+      for (unsigned i = 0; i < Server_threads::count(); ++i)
+        Server_threads::thread(i)->modify_senders(todo);
     }
 }
 
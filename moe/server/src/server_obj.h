@@ -12,6 +12,8 @@
 #include <l4/cxx/weak_ref>
 #include <l4/sys/cxx/ipc_epiface>
 
+#include <cstddef>
+
 
 namespace Moe
 {
@@ -36,6 +38,36 @@ public:
   void add_weak_ref(cxx::Weak_ref_base *obj) const;
   void remove_weak_ref(cxx::Weak_ref_base *obj) const;
 
+  /**
+   * Free the memory of a deleted object.
+   *
+   * The label of an IPC gate is the address of its object. With several
+   * server threads, another thread may already have received a message
+   * for the object and wait for the request lock. The memory is therefore
+   * kept until every server thread passed a dispatch boundary, see
+   * quiescent().
+   */
+  static void operator delete (void *p, std::size_t size) noexcept;
+
+  /// Is `o` part of an object that was deleted but not yet freed?
+  static bool is_deleted(L4::Epiface const *o) noexcept;
+
+  /**
+   * Dispatch boundary of the calling server thread.
+   *
+   * The thread holds no message for a deleted object anymore. Frees the
+   * objects that no server thread can reach anymore.
+   */
+  static void quiescent() noexcept;
+
+  /**
+   * Set up the deferred freeing for the running server threads.
+   *
+   * Each server thread gets an IRQ that wakes it up after an object was
+   * deleted, so that idle threads pass a dispatch boundary, too.
+   */
+  static void init_deferred_free();
+
 private:
   mutable cxx::Weak_ref_base::List _weak_ptrs;
   mutable L4::Cap<void> _weak_cap;
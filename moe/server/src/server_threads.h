@@ -0,0 +1,96 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/sys/capability>
+#include <l4/sys/consts.h>
+#include <l4/sys/thread>
+#include <l4/sys/utcb.h>
+
+#include "lock.h"
+
+namespace Moe {
+
+/**
+ * The threads that receive requests on Moe's IPC gates.
+ *
+ * Server thread 0 is Moe's initial thread. Additional server threads are
+ * started with the `--threads` option. Their UTCBs directly follow the UTCB
+ * of the initial thread, so the index of a server thread can be derived
+ * from its UTCB address.
+ */
+class Server_threads
+{
+public:
+  enum { Max_threads = L4_PAGESIZE / L4_UTCB_OFFSET };
+
+  /// Index of the calling server thread.
+  static unsigned self() noexcept
+  {
+    return (reinterpret_cast<l4_addr_t>(l4_utcb()) - _utcb_base)
+           / L4_UTCB_OFFSET;
+  }
+
+  /// Number of running server threads.
+  static unsigned count() noexcept { return _count; }
+
+  static L4::Cap<L4::Thread> thread(unsigned i) noexcept
+  { return _threads[i]; }
+
+  /**
+   * Server thread for a new IPC gate.
+   *
+   * Gates are distributed round robin across the server threads.
+   */
+  static L4::Cap<L4::Thread> gate_thread() noexcept
+  {
+    if (!_count)
+      return L4::Cap<L4::Thread>(L4_BASE_THREAD_CAP);
+
+    unsigned i = _next_gate++;
+    if (_next_gate >= _count)
+      _next_gate = 0;
+    return _threads[i];
+  }
+
+  /**
+   * UTCB for the server thread with the given index.
+   *
+   * \return The UTCB, or NULL if the UTCB area of Moe has no room for
+   *         the thread.
+   */
+  static l4_utcb_t *utcb(unsigned i) noexcept
+  {
+    l4_addr_t u = _utcb_base + i * L4_UTCB_OFFSET;
+    if (l4_trunc_page(u) != l4_trunc_page(_utcb_base))
+      return 0;
+    return reinterpret_cast<l4_utcb_t *>(u);
+  }
+
+  /// Register a running server thread, the initial thread must come first.
+  static void add(L4::Cap<L4::Thread> t) noexcept
+  {
+    if (!_count)
+      _utcb_base = reinterpret_cast<l4_addr_t>(l4_utcb());
+    _threads[_count++] = t;
+  }
+
+  /**
+   * Lock serializing the requests of the server threads.
+   *
+   * Page-fault requests to dataspaces are handled under the shared lock,
+   * everything else takes the lock exclusively.
+   */
+  static Rw_lock request_lock;
+
+private:
+  static l4_addr_t _utcb_base;
+  static unsigned _count;
+  static unsigned _next_gate;
+  static L4::Cap<L4::Thread> _threads[Max_threads];
+};
+
+}
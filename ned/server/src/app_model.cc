@@ -29,7 +29,11 @@ App_model::alloc_ds(unsigned long size) const
 App_model::Const_dataspace
 App_model::open_file(char const *name)
 {
-  L4Re::Util::Env_ns ens;
+  // every program needs the same few binaries from rom
+  static L4Re::Util::Env_ns_cache rom_cache("rom");
+  L4Re::Util::Env_ns ens(L4Re::Env::env(),
+                         L4Re::Cap_alloc::get_cap_alloc(L4Re::Util::cap_alloc),
+                         &rom_cache);
   return L4Re::chkcap(ens.query<L4Re::Dataspace>(name), name, 0);
 }
 
@@ -70,6 +74,13 @@ App_model::copy_ds(Dataspace dst, unsigned long dst_offs,
                "Ned program launch: copy failed");
 }
 
+void
+App_model::prefetch_ds(Dataspace ds, unsigned long offs, unsigned long size)
+{
+  // only a hint, the memory is still allocated on demand if this fails
+  ds->allocate(offs, size);
+}
+
 
 l4_addr_t
 App_model::local_attach_ds(Const_dataspace ds, unsigned long size,
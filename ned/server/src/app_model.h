@@ -69,6 +69,12 @@ struct App_model : public Ldr::Base_app_model<Stack>
 
   static bool all_segs_cow() { return false; }
 
+  bool prefetch_segs() const
+  { return prog_info()->ldr_flags & L4RE_AUX_LDR_FLAG_PREFETCH; }
+
+  static void prefetch_ds(Dataspace ds, unsigned long offs,
+                          unsigned long size);
+
   l4_addr_t local_attach_ds(Const_dataspace ds, unsigned long size,
                             unsigned long offset) const;
 
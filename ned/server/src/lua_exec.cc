@@ -13,6 +13,8 @@
 
 #include <l4/cxx/ref_ptr>
 #include <l4/libloader/elf>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
 #include <l4/util/bitops.h>
 
 #include <lua.h>
@@ -513,6 +515,8 @@ static int exec(lua_State *l)
 {
   try {
 
+  l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+
   Am am(l);
   am.parse_cfg();
 
@@ -531,6 +535,11 @@ static int exec(lua_State *l)
 
   am.launch_loader();
 
+  // The program loads itself in its own task, concurrently to the
+  // following launches. Only the part done by ned is accounted here.
+  Dbg(Dbg::Boot).printf("launched '%s' in %llu us\n", am.argv.a0,
+                        l4_kip_clock(l4re_kip()) - start);
+
   App_ptr *at = new (lua_newuserdata(l, sizeof(App_ptr))) App_ptr();
   *at = app_task;
 
@@ -161,6 +161,8 @@ struct elf_resolve {
 
 extern struct dyn_elf     * _dl_symbol_tables;
 extern struct elf_resolve * _dl_loaded_modules;
+extern unsigned long        _dl_load_adds;
+extern unsigned long        _dl_load_subs;
 extern struct dyn_elf     * _dl_handles;
 
 extern struct elf_resolve * _dl_add_elf_hash_table(const char * libname,
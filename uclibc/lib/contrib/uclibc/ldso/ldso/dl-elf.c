@@ -838,6 +838,8 @@ struct elf_resolve *_dl_load_elf_shared_library(unsigned int rflags,
 		DL_RELOC_ADDR(DL_GET_RUN_ADDR(tpnt->loadaddr, tpnt->mapaddr),
 		epnt->e_phoff);
 	tpnt->n_phent = epnt->e_phnum;
+	/* The program headers are set, announce the new module */
+	__atomic_add_fetch(&_dl_load_adds, 1, __ATOMIC_RELEASE);
 	tpnt->rtld_flags = rflags | rtld_flags;
 #ifdef __LDSO_STANDALONE_SUPPORT__
 	tpnt->l_entry = epnt->e_entry;
@@ -19,3 +19,10 @@
 
 struct elf_resolve *_dl_loaded_modules = NULL;
 
+/*
+ * Incremented whenever a module is added to or removed from
+ * _dl_loaded_modules, lets users of the list cache what they derive from it.
+ */
+unsigned long _dl_load_adds;
+unsigned long _dl_load_subs;
+
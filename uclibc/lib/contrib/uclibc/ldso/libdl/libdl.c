@@ -77,6 +77,7 @@ extern int _dl_errno;
 extern struct dyn_elf *_dl_symbol_tables;
 extern struct dyn_elf *_dl_handles;
 extern struct elf_resolve *_dl_loaded_modules;
+extern unsigned long _dl_load_subs;
 extern void _dl_free (void *__ptr);
 extern struct r_debug *_dl_debug_addr;
 extern unsigned long _dl_error_number;
@@ -1018,6 +1019,7 @@ static int do_dlclose(void *vhandle, int need_fini)
 					}
 				}
 			}
+			__atomic_add_fetch(&_dl_load_subs, 1, __ATOMIC_RELEASE);
 
 			/* Next, remove tpnt from the global symbol table list */
 			if (_dl_symbol_tables) {
@@ -15,6 +15,10 @@ l4_cap_idx_t pthread_l4_cap(pthread_t t);
 
 void pthread_l4_for_each_thread(void (*fn)(pthread_t));
 
+/* Execution time of the exited threads in microseconds. The returned
+   counter changes whenever a thread exits. */
+unsigned long pthread_l4_exited_threads_time(l4_kernel_clock_t *us);
+
 static inline l4_utcb_t *pthread_l4_utcb(pthread_t t);
 
 int pthread_l4_start(pthread_t thread, void *(*func)(void *), void *arg);
@@ -24,6 +24,9 @@
 
 #include <l4/util/util.h>
 
+/* Provided by the thread-caching malloc, if configured */
+extern void __malloc_thread_exit(void) __attribute__((weak));
+
 void
 attribute_hidden
 __pthread_exit(void * retval)
@@ -46,6 +49,9 @@ __pthread_do_exit(void *retval, char *currentframe)
   /* Call cleanup functions and destroy the thread-specific data */
   __pthread_perform_cleanup(currentframe);
   __pthread_destroy_specifics();
+  /* Give the memory cached by malloc for this thread back */
+  if (__malloc_thread_exit)
+    __malloc_thread_exit();
   /* Store return value */
   __pthread_lock(THREAD_GETMEM(self, p_lock), self);
   THREAD_SETMEM(self, p_retval, retval);
@@ -37,6 +37,24 @@ l4_cap_idx_t pthread_l4_cap(pthread_t thread_id)
   return c;
 }
 
+unsigned long __pthread_l4_exited_seq;
+l4_kernel_clock_t __pthread_l4_exited_time;
+
+unsigned long pthread_l4_exited_threads_time(l4_kernel_clock_t *us)
+{
+  unsigned long seq;
+  do
+    {
+      seq = __atomic_load_n(&__pthread_l4_exited_seq, __ATOMIC_ACQUIRE);
+      *us = *(l4_kernel_clock_t volatile *)&__pthread_l4_exited_time;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+  while ((seq & 1)
+         || seq != __atomic_load_n(&__pthread_l4_exited_seq, __ATOMIC_RELAXED));
+
+  return seq;
+}
+
 static void cb(void *arg, pthread_descr th)
 {
   void (*fn)(pthread_t) = (void (*)(pthread_t))arg;
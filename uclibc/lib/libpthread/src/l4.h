@@ -4,6 +4,10 @@
 
 typedef L4::Semaphore Th_sem_cap;
 
+/* Written by the manager thread only, odd while it is updated. */
+extern unsigned long __pthread_l4_exited_seq attribute_hidden;
+extern l4_kernel_clock_t __pthread_l4_exited_time attribute_hidden;
+
 inline int __alloc_thread_sem(pthread_descr th, L4::Cap<Th_sem_cap> const &c)
 {
   return l4_error(L4Re::Env::env()->factory()->create(c));
@@ -380,6 +380,66 @@ static int pthread_l4_free_stack(void *stack_addr, void *guardaddr)
 
   return e->rm()->free_area((l4_addr_t)guardaddr);
 }
+
+/*
+ * Cache of the stacks of terminated threads.
+ *
+ * Setting up a stack costs an area reservation, a dataspace allocation and
+ * an attach, releasing it a detach and freeing the area. Programs that
+ * create many short-lived threads mostly use the same stack size, so the
+ * manager keeps a few stacks of terminated threads, still attached, for
+ * the next threads. Only the manager thread uses the cache.
+ */
+enum { Stack_cache_size = 8 };
+
+struct Cached_stack
+{
+  char *guardaddr;
+  size_t guardsize;
+  size_t stacksize;
+};
+
+static Cached_stack stack_cache[Stack_cache_size];
+static unsigned stack_cache_num;
+
+/*
+ * Take a stack with the given guard and stack size from the cache. Return
+ * the guard address of the stack or NULL if there is no such stack.
+ */
+static char *stack_cache_get(size_t guardsize, size_t stacksize)
+{
+  for (unsigned i = stack_cache_num; i > 0; --i)
+    {
+      Cached_stack *c = &stack_cache[i - 1];
+      if (c->guardsize != guardsize || c->stacksize != stacksize)
+        continue;
+
+      char *guardaddr = c->guardaddr;
+      *c = stack_cache[--stack_cache_num];
+      return guardaddr;
+    }
+
+  return NULL;
+}
+
+/*
+ * Release the stack of a terminated thread, keep it in the cache if there
+ * is room.
+ */
+static int pthread_l4_release_stack(char *guardaddr, size_t guardsize,
+                                    size_t stacksize)
+{
+  if (stack_cache_num < Stack_cache_size)
+    {
+      Cached_stack *c = &stack_cache[stack_cache_num++];
+      c->guardaddr = guardaddr;
+      c->guardsize = guardsize;
+      c->stacksize = stacksize;
+      return 0;
+    }
+
+  return pthread_l4_free_stack(guardaddr + guardsize, guardaddr);
+}
 #endif
 
 static int pthread_allocate_stack(const pthread_attr_t *attr,
@@ -465,40 +525,53 @@ static int pthread_allocate_stack(const pthread_attr_t *attr,
 	}
 
 #ifdef USE_L4RE_FOR_STACK
-      map_addr = 0;
-      L4Re::Env const *e = L4Re::Env::env();
-      long err;
+      if ((guardaddr = stack_cache_get(guardsize, stacksize)))
+        {
+          new_thread_bottom = guardaddr + guardsize;
+# ifndef USE_TLS
+          /* The thread descriptor lives on the stack, a fresh stack would
+             be zeroed.  */
+          memset((pthread_descr) (new_thread_bottom + stacksize) - 1, 0,
+                 sizeof(struct pthread));
+# endif
+        }
+      else
+        {
+          map_addr = 0;
+          L4Re::Env const *e = L4Re::Env::env();
+          long err;
 
-      if (e->rm()->reserve_area(&map_addr, stacksize + guardsize,
-	                        L4Re::Rm::F::Search_addr) < 0)
-	return -1;
+          if (e->rm()->reserve_area(&map_addr, stacksize + guardsize,
+                                    L4Re::Rm::F::Search_addr) < 0)
+            return -1;
 
-      guardaddr = (char*)map_addr;
+          guardaddr = (char*)map_addr;
 
-      L4::Cap<L4Re::Dataspace> ds = L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>();
-      if (!ds.is_valid())
-	return -1;
+          L4::Cap<L4Re::Dataspace> ds = L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>();
+          if (!ds.is_valid())
+            return -1;
 
-      err = e->mem_alloc()->alloc(stacksize, ds);
+          err = e->mem_alloc()->alloc(stacksize, ds);
 
-      if (err < 0)
-	{
-	  L4Re::Util::cap_alloc.free(ds);
-	  e->rm()->free_area(l4_addr_t(map_addr));
-	  return -1;
-	}
+          if (err < 0)
+            {
+              L4Re::Util::cap_alloc.free(ds);
+              e->rm()->free_area(l4_addr_t(map_addr));
+              return -1;
+            }
 
-      new_thread_bottom = (char *) map_addr + guardsize;
-      err = e->rm()->attach(&new_thread_bottom, stacksize,
-                            L4Re::Rm::F::In_area | L4Re::Rm::F::RW,
-                            L4::Ipc::make_cap_rw(ds), 0);
+          new_thread_bottom = (char *) map_addr + guardsize;
+          err = e->rm()->attach(&new_thread_bottom, stacksize,
+                                L4Re::Rm::F::In_area | L4Re::Rm::F::RW,
+                                L4::Ipc::make_cap_rw(ds), 0);
 
-      if (err < 0)
-	{
-	  L4Re::Util::cap_alloc.free(ds, L4Re::This_task);
-	  e->rm()->free_area(l4_addr_t(map_addr));
-	  return -1;
-	}
+          if (err < 0)
+            {
+              L4Re::Util::cap_alloc.free(ds, L4Re::This_task);
+              e->rm()->free_area(l4_addr_t(map_addr));
+              return -1;
+            }
+        }
 #else
       map_addr = mmap(NULL, stacksize + guardsize,
                       PROT_READ | PROT_WRITE | PROT_EXEC,
@@ -892,7 +965,7 @@ static int pthread_handle_create(pthread_descr creator, const pthread_attr_t *at
 # endif
 #else
 #ifdef USE_L4RE_FOR_STACK
-        if (pthread_l4_free_stack(new_thread_bottom, guardaddr))
+        if (pthread_l4_release_stack(guardaddr, guardsize, stksize))
           fprintf(stderr, "ERROR: failed to free stack\n");
 #else
 # ifdef USE_TLS
@@ -993,7 +1066,12 @@ static void pthread_free(pthread_descr th)
 # endif
 #endif
 #ifdef USE_L4RE_FOR_STACK
-      pthread_l4_free_stack(guardaddr + guardsize, guardaddr);
+# ifdef USE_TLS
+      size_t stksize = th->p_stackaddr - guardaddr - guardsize;
+# else
+      size_t stksize = (char *)(th+1) - guardaddr - guardsize;
+# endif
+      pthread_l4_release_stack(guardaddr, guardsize, stksize);
 #else
       munmap(guardaddr, stacksize + guardsize);
 #endif
@@ -1021,6 +1099,17 @@ static int pthread_handle_thread_exit(pthread_descr th)
 
   ASSERT(th->p_terminated);
 
+  /* Keep the execution time of the thread for CLOCK_PROCESS_CPUTIME_ID */
+  l4_kernel_clock_t us;
+  if (l4_error(l4_thread_stats_time(th->p_th_cap, &us)) < 0)
+    us = 0;
+  __atomic_store_n(&__pthread_l4_exited_seq, __pthread_l4_exited_seq + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  *(l4_kernel_clock_t volatile *)&__pthread_l4_exited_time += us;
+  __atomic_store_n(&__pthread_l4_exited_seq, __pthread_l4_exited_seq + 1,
+                   __ATOMIC_RELEASE);
+
   int detached;
   /* Remove thread from list of active threads */
   th->p_nextlive->p_prevlive = th->p_prevlive;
@@ -15,6 +15,20 @@
 */
 
 #include <features.h>
+
+#if defined __UCLIBC_MALLOC_TCACHE__ && !defined __MALLOC_TCACHE_FRONTEND
+/*
+ * The thread cache (tcache.c) provides the public allocator functions,
+ * the functions of this allocator get internal names. This has to happen
+ * before the declarations in the standard headers.
+ */
+# define malloc   __malloc_std
+# define free     __free_std
+# define realloc  __realloc_std
+# define calloc   __calloc_std
+# define memalign __memalign_std
+#endif
+
 #include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
@@ -34,6 +48,14 @@ __UCLIBC_MUTEX_EXTERN(__malloc_lock);
 #define __MALLOC_LOCK		__UCLIBC_MUTEX_LOCK(__malloc_lock)
 #define __MALLOC_UNLOCK		__UCLIBC_MUTEX_UNLOCK(__malloc_lock)
 
+#ifdef __UCLIBC_MALLOC_TCACHE__
+void *__malloc_std(size_t bytes) attribute_hidden;
+void __free_std(void *mem) attribute_hidden;
+void *__realloc_std(void *oldmem, size_t bytes) attribute_hidden;
+void *__calloc_std(size_t n_elements, size_t elem_size) attribute_hidden;
+void *__memalign_std(size_t alignment, size_t bytes) attribute_hidden;
+#endif
+
 
 
 /*
@@ -0,0 +1,327 @@
+/*
+ * Thread cache in front of malloc-standard.
+ *
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+
+/*
+ * Every thread keeps lists of free chunks per size class. Small
+ * allocations and frees are served from these lists without any lock.
+ * Chunks move between the threads in batches through a central transfer
+ * cache, one spin lock per size class. Only if the transfer cache is
+ * empty or full, chunks are allocated from or given back to the
+ * underlying allocator, under the global malloc lock.
+ *
+ * Cached chunks stay allocated chunks of malloc-standard: their size is
+ * taken from the chunk header, realloc() and friends work on them
+ * unchanged. Chunks given back to malloc-standard are subject to its
+ * usual trimming, which returns free memory at the top of the heap to the
+ * memory allocator.
+ *
+ * Only built with __UCLIBC_MALLOC_TCACHE__, which renames the functions
+ * of malloc-standard (see malloc.h).
+ */
+
+#define __MALLOC_TCACHE_FRONTEND
+#include "malloc.h"
+
+#include <libc-internal.h>
+#include <l4/sys/thread.h>
+
+#ifndef __UCLIBC_HAS_TLS__
+#error The thread cache needs thread-local storage.
+#endif
+
+/* Largest chunk size that is cached. */
+#define TC_MAX_CHUNK   1024
+/* Number of size classes, one per possible chunk size. */
+#define TC_CLASSES     ((TC_MAX_CHUNK - MINSIZE) / MALLOC_ALIGNMENT + 1)
+/* Full batches per size class in the transfer cache. */
+#define TC_CENTRAL_MAX 8
+
+struct tc_bin
+{
+  void *head;
+  unsigned count;
+};
+
+/* The chunks cached by a thread. */
+struct tc_cache
+{
+  struct tc_bin bins[TC_CLASSES];
+};
+
+/*
+ * Batches of a size class in the transfer cache.
+ *
+ * The chunks of a batch are linked through their first word, the batches
+ * through the second word of their first chunk.
+ */
+struct tc_central
+{
+  void *batches;
+  unsigned count;
+  int lock;
+};
+
+static __thread struct tc_cache tc attribute_tls_model_ie;
+static struct tc_central tc_central[TC_CLASSES];
+
+static __always_inline unsigned
+tc_class(size_t size)
+{
+  return (size - MINSIZE) / MALLOC_ALIGNMENT;
+}
+
+static __always_inline size_t
+tc_size(unsigned c)
+{
+  return MINSIZE + c * MALLOC_ALIGNMENT;
+}
+
+/* Number of chunks moved at once, more for smaller chunks. */
+static __always_inline unsigned
+tc_batch(unsigned c)
+{
+  unsigned n = 4096 / tc_size(c);
+  return n < 2 ? 2 : n > 32 ? 32 : n;
+}
+
+static __always_inline void **
+tc_next(void *m)
+{
+  return (void **)m;
+}
+
+static __always_inline void **
+tc_next_batch(void *m)
+{
+  return (void **)m + 1;
+}
+
+static void
+tc_lock(int *l)
+{
+  while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE))
+    l4_thread_yield();
+}
+
+static void
+tc_unlock(int *l)
+{
+  __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+/* Give a list of chunks back to malloc-standard. */
+static void
+tc_free_list(void *m)
+{
+  __MALLOC_LOCK;
+  while (m)
+    {
+      void *n = *tc_next(m);
+      __free_std(m);
+      m = n;
+    }
+  __MALLOC_UNLOCK;
+}
+
+/*
+ * Fill the empty list of a size class.
+ *
+ * Takes a batch from the transfer cache or allocates a new one.
+ */
+static int
+tc_refill(unsigned c)
+{
+  struct tc_bin *b = &tc.bins[c];
+  struct tc_central *t = &tc_central[c];
+  unsigned batch = tc_batch(c);
+
+  if (__atomic_load_n(&t->count, __ATOMIC_RELAXED))
+    {
+      void *m = 0;
+      tc_lock(&t->lock);
+      if (t->count)
+        {
+          m = t->batches;
+          t->batches = *tc_next_batch(m);
+          --t->count;
+        }
+      tc_unlock(&t->lock);
+
+      if (m)
+        {
+          b->head = m;
+          b->count = batch;
+          return 1;
+        }
+    }
+
+  /* Chunks may be larger than requested, they are cached by their real
+     size when freed. */
+  size_t req = tc_size(c) - sizeof(size_t);
+  unsigned n = 0;
+  __MALLOC_LOCK;
+  for (; n < batch; ++n)
+    {
+      void *m = __malloc_std(req);
+      if (!m)
+        break;
+      *tc_next(m) = b->head;
+      b->head = m;
+    }
+  __MALLOC_UNLOCK;
+
+  b->count = n;
+  return n != 0;
+}
+
+/* Move a batch of chunks out of an overfull list. */
+static void
+tc_release(unsigned c)
+{
+  struct tc_bin *b = &tc.bins[c];
+  struct tc_central *t = &tc_central[c];
+  unsigned batch = tc_batch(c);
+
+  void *first = b->head;
+  void *last = first;
+  for (unsigned i = 1; i < batch; ++i)
+    last = *tc_next(last);
+
+  b->head = *tc_next(last);
+  b->count -= batch;
+  *tc_next(last) = 0;
+
+  tc_lock(&t->lock);
+  if (t->count < TC_CENTRAL_MAX)
+    {
+      *tc_next_batch(first) = t->batches;
+      t->batches = first;
+      ++t->count;
+      first = 0;
+    }
+  tc_unlock(&t->lock);
+
+  if (first)
+    tc_free_list(first);
+}
+
+/*
+ * Give back the chunks cached by the current thread.
+ *
+ * Called by libpthread when a thread exits.
+ */
+void __malloc_thread_exit(void);
+void
+__malloc_thread_exit(void)
+{
+  for (unsigned c = 0; c < TC_CLASSES; ++c)
+    {
+      struct tc_bin *b = &tc.bins[c];
+      if (!b->head)
+        continue;
+
+      tc_free_list(b->head);
+      b->head = 0;
+      b->count = 0;
+    }
+}
+
+void *
+malloc(size_t bytes)
+{
+  if (bytes < TC_MAX_CHUNK)
+    {
+      size_t nb = request2size(bytes);
+      if (nb <= TC_MAX_CHUNK)
+        {
+          unsigned c = tc_class(nb);
+          struct tc_bin *b = &tc.bins[c];
+          if (b->head || tc_refill(c))
+            {
+              void *m = b->head;
+              b->head = *tc_next(m);
+              --b->count;
+              return m;
+            }
+        }
+    }
+
+  return __malloc_std(bytes);
+}
+
+void
+free(void *mem)
+{
+  if (!mem)
+    return;
+
+  mchunkptr p = mem2chunk(mem);
+  size_t size = chunksize(p);
+  if (chunk_is_mmapped(p) || size > TC_MAX_CHUNK)
+    {
+      __free_std(mem);
+      return;
+    }
+
+  unsigned c = tc_class(size);
+  struct tc_bin *b = &tc.bins[c];
+  *tc_next(mem) = b->head;
+  b->head = mem;
+  if (++b->count >= 2 * tc_batch(c))
+    tc_release(c);
+}
+
+void *
+calloc(size_t n_elements, size_t elem_size)
+{
+  size_t size = n_elements * elem_size;
+  if (n_elements && elem_size != size / n_elements)
+    {
+      __set_errno(ENOMEM);
+      return NULL;
+    }
+
+  if (size >= TC_MAX_CHUNK)
+    return __calloc_std(n_elements, elem_size);
+
+  void *m = malloc(size);
+  if (m)
+    memset(m, 0, size);
+  return m;
+}
+
+void *
+realloc(void *oldmem, size_t bytes)
+{
+  if (!oldmem)
+    return malloc(bytes);
+
+  if (!bytes)
+    {
+      free(oldmem);
+      return NULL;
+    }
+
+  return __realloc_std(oldmem, bytes);
+}
+
+void *
+memalign(size_t alignment, size_t bytes)
+{
+  if (alignment <= MALLOC_ALIGNMENT)
+    return malloc(bytes);
+
+  return __memalign_std(alignment, bytes);
+}
+libc_hidden_def(memalign)
+
+void *
+aligned_alloc(size_t alignment, size_t bytes)
+{
+  return memalign(alignment, bytes);
+}
@@ -8,6 +8,12 @@
  * \file
  * Implementation of _dl_find_object() which is referenced by libgcc as of gcc
  * version 12.
+ *
+ * The unwinder calls _dl_find_object() for every frame of a thrown exception.
+ * Instead of scanning the program headers of all loaded objects on each call,
+ * the loaded segments are kept in a table sorted by address. The table is
+ * rebuilt when the dynamic linker adds or removes an object, which it
+ * announces by incrementing _dl_load_adds and _dl_load_subs.
  */
 
 #include <sys/cdefs.h>
@@ -28,6 +34,7 @@
 #undef _LIBC
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <elf.h>
 
 #include <link.h>
@@ -103,6 +110,196 @@ callback(struct dl_phdr_info *info, size_t size, void *data)
   return 0;
 }
 
+/// A loaded segment.
+struct Segment
+{
+  unsigned long start;
+  unsigned long end;
+  void *eh_frame;
+};
+
+/// Loaded segments sorted by address.
+struct Table
+{
+  // Counters of the dynamic linker the table was built for.
+  unsigned long adds;
+  unsigned long subs;
+  unsigned cap;
+  unsigned count;
+  Segment seg[];
+};
+
+extern "C" unsigned long _dl_load_adds;
+extern "C" unsigned long _dl_load_subs;
+
+/*
+ * Two tables, _tables[_version & 1] is the current one. A rebuild writes
+ * the other table and then increments _version, readers retry if _version
+ * changed during their lookup. A table that is too small is replaced by a
+ * larger one and not freed as readers may still look at it. The tables
+ * only grow, so this wastes at most as much memory as the tables use.
+ */
+static Table *_tables[2];
+static unsigned long _version;
+static int _rebuild_lock;
+
+static bool
+current(Table const *t)
+{
+  return t
+         && t->adds == __atomic_load_n(&_dl_load_adds, __ATOMIC_ACQUIRE)
+         && t->subs == __atomic_load_n(&_dl_load_subs, __ATOMIC_ACQUIRE);
+}
+
+static int
+count_segments(struct dl_phdr_info *info, size_t, void *data)
+{
+  for (unsigned i = 0; i < info->dlpi_phnum; ++i)
+    if (info->dlpi_phdr[i].p_type == PT_LOAD)
+      ++*static_cast<unsigned *>(data);
+
+  return 0;
+}
+
+static int
+add_segments(struct dl_phdr_info *info, size_t, void *data)
+{
+  auto *t = static_cast<Table *>(data);
+
+  void *eh_frame = nullptr;
+  for (unsigned i = 0; i < info->dlpi_phnum; ++i)
+    if (info->dlpi_phdr[i].p_type == PT_GNU_EH_FRAME)
+      eh_frame = (void *)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+
+  for (unsigned i = 0; i < info->dlpi_phnum; ++i)
+    {
+      if (info->dlpi_phdr[i].p_type != PT_LOAD)
+        continue;
+
+      // objects loaded meanwhile are picked up by the next rebuild
+      if (t->count == t->cap)
+        return 1;
+
+      Segment s;
+      s.start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+      s.end = s.start + info->dlpi_phdr[i].p_memsz;
+      s.eh_frame = eh_frame;
+
+      // insertion sort, segments of an object are mostly in order already
+      unsigned j = t->count++;
+      for (; j > 0 && t->seg[j - 1].start > s.start; --j)
+        t->seg[j] = t->seg[j - 1];
+      t->seg[j] = s;
+    }
+
+  return 0;
+}
+
+/**
+ * Build the current table.
+ *
+ * \retval true   The current table was built.
+ * \retval false  Another thread builds the table or there is no memory,
+ *                the caller has to search the objects itself.
+ */
+static bool
+rebuild()
+{
+  if (__atomic_exchange_n(&_rebuild_lock, 1, __ATOMIC_ACQUIRE))
+    return false;
+
+  bool ok = false;
+  unsigned long adds = __atomic_load_n(&_dl_load_adds, __ATOMIC_ACQUIRE);
+  unsigned long subs = __atomic_load_n(&_dl_load_subs, __ATOMIC_ACQUIRE);
+  unsigned long v = _version;
+
+  if (!current(_tables[v & 1]))
+    {
+      unsigned n = 0;
+      dl_iterate_phdr(count_segments, &n);
+
+      Table *t = _tables[(v + 1) & 1];
+      if (!t || t->cap < n)
+        {
+          // some room for objects loaded later
+          unsigned cap = n + n / 2 + 8;
+          t = static_cast<Table *>(malloc(sizeof(Table) + cap * sizeof(Segment)));
+          if (t)
+            {
+              t->cap = cap;
+              __atomic_store_n(&_tables[(v + 1) & 1], t, __ATOMIC_RELAXED);
+            }
+        }
+
+      if (t)
+        {
+          t->adds = adds;
+          t->subs = subs;
+          t->count = 0;
+          dl_iterate_phdr(add_segments, t);
+          __atomic_store_n(&_version, v + 1, __ATOMIC_RELEASE);
+          ok = true;
+        }
+    }
+  else
+    ok = true;
+
+  __atomic_store_n(&_rebuild_lock, 0, __ATOMIC_RELEASE);
+  return ok;
+}
+
+/**
+ * Look up an address in the current table.
+ *
+ * \retval 1   Found, `result` is filled.
+ * \retval 0   Not found.
+ * \retval -1  No current table.
+ */
+static int
+lookup(unsigned long addr, Dl_find_object *result)
+{
+  for (;;)
+    {
+      unsigned long v = __atomic_load_n(&_version, __ATOMIC_ACQUIRE);
+      Table const *t = __atomic_load_n(&_tables[v & 1], __ATOMIC_ACQUIRE);
+      if (!current(t))
+        return -1;
+
+      unsigned count = __atomic_load_n(&t->count, __ATOMIC_RELAXED);
+      if (count > t->cap)
+        count = t->cap;
+
+      // find the last segment starting at or below the address
+      unsigned lo = 0, hi = count;
+      while (lo < hi)
+        {
+          unsigned mid = lo + (hi - lo) / 2;
+          if (t->seg[mid].start <= addr)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      Segment s = { 0, 0, nullptr };
+      if (lo > 0)
+        s = t->seg[lo - 1];
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&_version, __ATOMIC_RELAXED) != v)
+        continue;
+
+      if (addr < s.start || addr >= s.end)
+        return 0;
+
+      result->dlfo_flags = 0;
+      result->dlfo_map_start = (void *)s.start;
+      result->dlfo_map_end = (void *)s.end;
+      result->dlfo_link_map = nullptr;
+      result->dlfo_eh_frame = s.eh_frame;
+      return 1;
+    }
+}
+
 /**
  * See the documentation in
  * https://www.gnu.org/software/libc/manual/html_node/Dynamic-Linker-Introspection.html
@@ -110,6 +307,13 @@ callback(struct dl_phdr_info *info, size_t size, void *data)
 extern "C" int _dl_find_object(void *address, Dl_find_object *result) noexcept;
 int _dl_find_object(void *address, Dl_find_object *result) noexcept
 {
+  int r = lookup((unsigned long)address, result);
+  if (r < 0 && rebuild())
+    r = lookup((unsigned long)address, result);
+
+  if (r >= 0)
+    return r ? 0 : -1;
+
   Shared_data data = { address, result, false };
   dl_iterate_phdr(callback, &data);
 
@@ -151,6 +151,10 @@ define SRC_libc/stdlib/malloc-standard
   realloc
 endef
 
+define SRC_libc/stdlib/malloc-standard_tcache
+  tcache
+endef
+
 define SRC_libc/stdlib/malloc-simple
   alloc
   calloc